@@ -0,0 +1,32 @@
+# Scaling of kmeans-parallel with the number of processes of a sharded run
+# usage: OPTIONS="[kmeans-parallel options]" sh bench-processes.sh [datafile] [process counts...]
+# prints one CSV row per transport and process count: total time, the time spent
+# assigning the points of the shard of rank 0 and the time spent combining the views,
+# allreduce included (microseconds, summed over the iterations from --telemetry), then
+# the speedup of the total over the single process row of the transport. Every process
+# gets the cores divided by the number of processes unless OPTIONS sets --threads.
+
+datafile=${1:-datasets/big_one.txt}
+[ $# -gt 0 ] && shift
+processes=${@:-1 2 4 8}
+telemetry=$(mktemp)
+
+make FILE=kmeans-parallel > /dev/null
+
+echo "transport,processes,iterations,total_us,assign_us,reduce_us,speedup"
+for transport in shm tcp
+do
+	baseline=""
+	for p in $processes
+	do
+		output=$(./bin/kmeans-parallel $datafile $OPTIONS --processes $p --transport $transport --telemetry $telemetry)
+		iterations=$(echo "$output" | awk '/Break in iteration/ {print $4}')
+		total_us=$(echo "$output" | awk '/TOTAL EXECUTION TIME/ {print $5}')
+		phases=$(awk -F'"assign_us": |, "reduce_us": |, "update_us": ' \
+			'{assign += $2; reduce += $3} END {printf "%d,%d", assign, reduce}' $telemetry)
+		[ -z "$baseline" ] && baseline=$total_us
+		echo "$transport,$p,$iterations,$total_us,$phases,$(echo "$baseline $total_us" | awk '{printf "%.2f", $1 / $2}')"
+	done
+done
+
+rm -f $telemetry $telemetry.*
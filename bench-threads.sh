@@ -0,0 +1,28 @@
+# Scaling of kmeans-parallel with the number of threads
+# usage: OPTIONS="[kmeans-parallel options]" sh bench-threads.sh [datafile] [thread counts...]
+# prints one CSV row per thread count: total time and the time spent assigning the points,
+# combining the thread local views and recomputing the centers (microseconds, summed over
+# the iterations from --telemetry), then the speedup of the total over the first row
+
+datafile=${1:-datasets/beans.txt}
+[ $# -gt 0 ] && shift
+cores=$(nproc)
+threads=${@:-$(t=1; while [ $t -lt $cores ]; do printf "%s " $t; t=$((t * 2)); done; echo $cores)}
+telemetry=$(mktemp)
+
+make FILE=kmeans-parallel > /dev/null
+
+echo "threads,iterations,total_us,assign_us,reduce_us,update_us,speedup"
+baseline=""
+for t in $threads
+do
+	output=$(./bin/kmeans-parallel $datafile $OPTIONS --threads $t --telemetry $telemetry)
+	iterations=$(echo "$output" | awk '/Break in iteration/ {print $4}')
+	total_us=$(echo "$output" | awk '/TOTAL EXECUTION TIME/ {print $5}')
+	phases=$(awk -F'"assign_us": |, "reduce_us": |, "update_us": |, "changed"' \
+		'{assign += $2; reduce += $3; update += $4} END {printf "%d,%d,%d", assign, reduce, update}' $telemetry)
+	[ -z "$baseline" ] && baseline=$total_us
+	echo "$t,$iterations,$total_us,$phases,$(echo "$baseline $total_us" | awk '{printf "%.2f", $1 / $2}')"
+done
+
+rm -f $telemetry
@@ -0,0 +1,20 @@
+# Speedup of the yinyang assignment over brute force as K grows
+# usage: sh bench-yinyang.sh [datafile] [K values...]
+# prints one CSV row per K: K, iterations, brute force time, yinyang time (microseconds), speedup
+
+datafile=${1:-datasets/birch.txt}
+[ $# -gt 0 ] && shift
+ks=${@:-25 50 100 200 400 800}
+
+make FILE=kmeans-parallel > /dev/null
+
+echo "K,iterations,brute_us,yinyang_us,speedup"
+for k in $ks
+do
+	brute=$(./bin/kmeans-parallel $datafile --k $k --assign brute)
+	yinyang=$(./bin/kmeans-parallel $datafile --k $k --assign yinyang)
+	iterations=$(echo "$brute" | awk '/Break in iteration/ {print $4}')
+	brute_us=$(echo "$brute" | awk '/TOTAL EXECUTION TIME/ {print $5}')
+	yinyang_us=$(echo "$yinyang" | awk '/TOTAL EXECUTION TIME/ {print $5}')
+	echo "$k,$iterations,$brute_us,$yinyang_us,$(echo "$brute_us $yinyang_us" | awk '{printf "%.2f", $1 / $2}')"
+done
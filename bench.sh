@@ -0,0 +1,62 @@
+# Benchmark of kmeans-serial, better-kmeans-serial and kmeans-parallel on every dataset
+# usage: sh bench.sh [repetitions] [warmup runs] [output directory]
+# make bench REPS=... WARMUP=... BENCH_DIR=... builds the three programs first
+#
+# Every program runs the warmup runs unmeasured, then the repetitions. The median,
+# p10 and p90 of TOTAL EXECUTION TIME (microseconds) and the speedup of the median
+# over kmeans-serial are written to results.csv and results.json in the output
+# directory, along with the commit and the date so runs can be compared over time.
+
+reps=${1:-5}
+warmup=${2:-1}
+out=${3:-outputs/bench}
+bin=${BIN_DIR:-bin}
+programs="kmeans-serial better-kmeans-serial kmeans-parallel"
+
+mkdir -p $out
+commit=$(git rev-parse --short HEAD 2>/dev/null)
+date=$(date -u +%Y-%m-%dT%H:%M:%SZ)
+
+csv=$out/results.csv
+json=$out/results.json
+echo "dataset,program,repetitions,median_us,p10_us,p90_us,speedup" > $csv
+printf '{\n  "commit": "%s",\n  "date": "%s",\n  "repetitions": %s,\n  "warmup": %s,\n  "results": [' $commit $date $reps $warmup > $json
+
+separator=""
+for datafile in datasets/*.txt
+do
+	dataset=$(basename $datafile .txt)
+	baseline=""
+	for program in $programs
+	do
+		i=0
+		while [ $i -lt $warmup ]; do
+			./$bin/$program $datafile > /dev/null
+			i=$((i + 1))
+		done
+
+		# one time per line, sorted, then nearest rank percentiles
+		stats=$(i=0; while [ $i -lt $reps ]; do
+				./$bin/$program $datafile | awk '/TOTAL EXECUTION TIME/ {print $5}'
+				i=$((i + 1))
+			done | sort -n | awk '
+			{ t[NR] = $1 }
+			END {
+				median = NR % 2 ? t[(NR + 1) / 2] : (t[NR / 2] + t[NR / 2 + 1]) / 2
+				p10 = int(NR * 0.1 + 0.999999); if(p10 < 1) p10 = 1
+				p90 = int(NR * 0.9 + 0.999999)
+				printf "%d %d %d", median, t[p10], t[p90]
+			}')
+		set -- $stats
+		median=$1 p10=$2 p90=$3
+		[ -z "$baseline" ] && baseline=$median
+		speedup=$(echo "$baseline $median" | awk '{printf "%.2f", ($2 > 0 ? $1 / $2 : 0)}')
+
+		echo "$dataset,$program,$reps,$median,$p10,$p90,$speedup" | tee -a $csv
+		printf '%s\n    {"dataset": "%s", "program": "%s", "median_us": %s, "p10_us": %s, "p90_us": %s, "speedup": %s}' \
+			"$separator" $dataset $program $median $p10 $p90 $speedup >> $json
+		separator=","
+	done
+done
+
+printf '\n  ]\n}\n' >> $json
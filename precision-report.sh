@@ -0,0 +1,24 @@
+# Label agreement of the float32 mode of kmeans-parallel with the float64 one
+# usage: sh precision-report.sh [datafiles...]
+# prints one CSV row per dataset: iterations and time (microseconds) of both runs and
+# the fraction of points given the same cluster; both runs start from the same centers
+
+datafiles=${@:-datasets/*.txt}
+labels=$(mktemp -d)
+
+make FILE=kmeans-parallel > /dev/null
+
+echo "dataset,iterations_float64,iterations_float32,float64_us,float32_us,agreement"
+for datafile in $datafiles
+do
+	double=$(./bin/kmeans-parallel $datafile --precision float64 --labels $labels/float64)
+	single=$(./bin/kmeans-parallel $datafile --precision float32 --labels $labels/float32)
+	iterations_double=$(echo "$double" | awk '/Break in iteration/ {print $4}')
+	iterations_single=$(echo "$single" | awk '/Break in iteration/ {print $4}')
+	double_us=$(echo "$double" | awk '/TOTAL EXECUTION TIME/ {print $5}')
+	single_us=$(echo "$single" | awk '/TOTAL EXECUTION TIME/ {print $5}')
+	agreement=$(paste $labels/float64 $labels/float32 | awk '$1 == $2 {same++} END {printf "%.6f", same / NR}')
+	echo "$(basename $datafile .txt),$iterations_double,$iterations_single,$double_us,$single_us,$agreement"
+done
+
+rm -rf $labels
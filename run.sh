@@ -1,25 +1,12 @@
-# When making the parallel executable, we will need to edit some constants for use in creating TLS Views depending on the dataset we are using
+# K and the number of values per point are read from the dataset header at runtime,
+# so the same executables serve every dataset
 
 datafile=$1
-line=$(sed "1q" ${datafile})
-total_values=$(echo "$line" | awk '{print $2}')
-K=$(echo "$line" | awk '{print $3}')
-
-dataline1=21
-dataline2=22
-
-sed -i "${dataline1}c\const int constK = $K;" src/kmeans-parallel.cpp
-sed -i "${dataline2}c\const int const_total_values = $total_values;" src/kmeans-parallel.cpp
 
 # First make the executables
-sed -i '2c\FILE := kmeans-serial' Makefile
-make
-
-sed -i '2c\FILE := better-kmeans-serial' Makefile
-make
-
-sed -i '2c\FILE := kmeans-parallel' Makefile
-make
+make FILE=kmeans-serial
+make FILE=better-kmeans-serial
+make FILE=kmeans-parallel
 
 mkdir outputs/$2
 
@@ -0,0 +1,71 @@
+// Heap allocation counter for the instrumented build (make alloc-check)
+// When COUNT_ALLOCATIONS is defined the global operator new is replaced by one
+// that counts every call, so KMeans::run can check that an iteration after the
+// first one does not touch the heap.
+
+#ifndef KMEANS_ALLOCATIONS_H
+#define KMEANS_ALLOCATIONS_H
+
+#include <atomic>
+#include <cstddef>
+
+#ifdef COUNT_ALLOCATIONS
+
+#include <cstdlib>
+#include <new>
+
+std::atomic<size_t> allocation_count(0);
+
+void* operator new(size_t size)
+{
+	allocation_count.fetch_add(1, std::memory_order_relaxed);
+	void* p = malloc(size ? size : 1);
+	if(p == nullptr)
+		throw std::bad_alloc();
+	return p;
+}
+
+void* operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void* operator new(size_t size, std::align_val_t alignment)
+{
+	allocation_count.fetch_add(1, std::memory_order_relaxed);
+	size_t align = (size_t)alignment;
+	void* p = aligned_alloc(align, (size + align - 1) / align * align);
+	if(p == nullptr)
+		throw std::bad_alloc();
+	return p;
+}
+
+void* operator new[](size_t size, std::align_val_t alignment)
+{
+	return operator new(size, alignment);
+}
+
+void operator delete(void* p) noexcept { free(p); }
+void operator delete[](void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+void operator delete[](void* p, size_t) noexcept { free(p); }
+void operator delete(void* p, std::align_val_t) noexcept { free(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { free(p); }
+void operator delete(void* p, size_t, std::align_val_t) noexcept { free(p); }
+void operator delete[](void* p, size_t, std::align_val_t) noexcept { free(p); }
+
+inline size_t allocationCount()
+{
+	return allocation_count.load(std::memory_order_relaxed);
+}
+
+#else
+
+inline size_t allocationCount()
+{
+	return 0;
+}
+
+#endif
+
+#endif
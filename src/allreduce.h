@@ -0,0 +1,388 @@
+// Allreduce between the processes of a sharded kmeans-parallel run (--processes)
+// Every process owns a shard of the points and, once per iteration, the cluster
+// sums of all of them are added together. sum() replaces values[0, count) on every
+// process with the total over the processes, added in rank order so every process
+// gets the same bits. Two transports are provided:
+//
+// shm : one POSIX shared memory region with a slot per process and a barrier;
+//       every process copies its values into its slot and adds up all the slots
+// tcp : every process connects to rank 0 over localhost, which adds up the values
+//       it receives and sends the total back
+//
+// Rank 0 creates the endpoint (the region name or the port) before the other
+// processes are started with it, then connect() completes the group everywhere.
+// A process that exits mid collective fails it on the others: over tcp its socket
+// closes, over shm the processes waiting on the barrier check every
+// ALLREDUCE_CHECK_MS that the others still run (see setPeer) and exit when one
+// does not. Rank 0 of tcp checks the same way while it waits for the others to
+// connect, so a process that fails to start does not leave it waiting.
+
+#ifndef KMEANS_ALLREDUCE_H
+#define KMEANS_ALLREDUCE_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <sched.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// doubles per slot of the shared memory transport, larger sums go through in chunks
+const size_t ALLREDUCE_CHUNK = 1 << 16;
+// how often a process waiting on the others (the shm barrier, the tcp accept) checks that they are alive
+const int ALLREDUCE_CHECK_MS = 100;
+
+class Allreduce
+{
+protected:
+	int rank, size;
+
+	// false once process pid has exited, even if nobody has reaped it yet
+	static bool alive(pid_t pid)
+	{
+		std::ifstream stat("/proc/" + std::to_string(pid) + "/stat");
+		std::string line;
+		if(!std::getline(stat, line))
+			return false;
+		size_t state = line.rfind(')');
+		return state != std::string::npos && state + 2 < line.size() && line[state + 2] != 'Z' && line[state + 2] != 'X';
+	}
+
+public:
+	Allreduce(int rank, int size)
+	{
+		this->rank = rank;
+		this->size = size;
+	}
+
+	virtual ~Allreduce() {}
+
+	int getRank()
+	{
+		return this->rank;
+	}
+
+	int getSize()
+	{
+		return this->size;
+	}
+
+	// what the other processes need to join, valid on rank 0 once constructed
+	virtual std::string getEndpoint() = 0;
+
+	// rank 0 tells the group the process id of rank, as soon as it is started
+	virtual void setPeer(int rank, pid_t pid) {}
+
+	// wait for the whole group, called once by every process after the others are started
+	virtual void connect() = 0;
+
+	virtual void sum(double* values, size_t count) = 0;
+};
+
+class ShmAllreduce : public Allreduce
+{
+private:
+	struct Header
+	{
+		std::atomic<int> arrived; // processes that reached the barrier
+		std::atomic<int> phase; // bumped by the last process to arrive
+		std::atomic<int> failed; // set by the first process that finds another one gone
+	};
+
+	std::string name;
+	size_t bytes;
+	Header* header;
+	std::atomic<pid_t>* pids; // size process ids, 0 until known
+	double* slots; // size x ALLREDUCE_CHUNK values
+
+	// bytes of the region before the slots: the header, then the process ids
+	static size_t slotsOffset(int size)
+	{
+		return 64 + (sizeof(std::atomic<pid_t>) * size + 63) / 64 * 64;
+	}
+
+	void fail(int peer)
+	{
+		header->failed.store(1, std::memory_order_release);
+		if(peer >= 0)
+			std::cerr << "Allreduce process " << peer << " exited";
+		else
+			std::cerr << "Allreduce failed in another process";
+		exit(1);
+	}
+
+	// generation barrier over the region, yielding so oversubscribed cores still progress
+	void barrier()
+	{
+		int phase = header->phase.load(std::memory_order_acquire);
+		if(header->arrived.fetch_add(1, std::memory_order_acq_rel) == size - 1) {
+			header->arrived.store(0, std::memory_order_relaxed);
+			header->phase.fetch_add(1, std::memory_order_release);
+			return;
+		}
+
+		auto check = std::chrono::steady_clock::now() + std::chrono::milliseconds(ALLREDUCE_CHECK_MS);
+		for(long spin = 1; header->phase.load(std::memory_order_acquire) == phase; spin++) {
+			sched_yield();
+			if(header->failed.load(std::memory_order_acquire))
+				fail(-1);
+			if(spin % 1024 != 0 || std::chrono::steady_clock::now() < check)
+				continue;
+			for(int r = 0; r < size; r++) {
+				pid_t pid = pids[r].load(std::memory_order_acquire);
+				if(r != rank && pid != 0 && !alive(pid))
+					fail(r);
+			}
+			check = std::chrono::steady_clock::now() + std::chrono::milliseconds(ALLREDUCE_CHECK_MS);
+		}
+	}
+
+public:
+	// an empty endpoint creates the region, as rank 0 does
+	ShmAllreduce(int rank, int size, const std::string& endpoint) : Allreduce(rank, size)
+	{
+		this->name = endpoint.empty() ? "/kmeans-allreduce-" + std::to_string(getpid()) : endpoint;
+		this->bytes = slotsOffset(size) + sizeof(double) * size * ALLREDUCE_CHUNK;
+
+		int fd = shm_open(name.c_str(), endpoint.empty() ? O_CREAT | O_EXCL | O_RDWR : O_RDWR, 0600);
+		if(fd < 0 || (endpoint.empty() && ftruncate(fd, bytes) != 0)) {
+			std::cerr << "Unable to open shared memory " << name;
+			exit(1);
+		}
+		void* region = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		close(fd);
+		if(region == MAP_FAILED) {
+			std::cerr << "Unable to map shared memory " << name;
+			exit(1);
+		}
+
+		this->header = (Header*)region;
+		this->pids = (std::atomic<pid_t>*)((char*)region + 64);
+		this->slots = (double*)((char*)region + slotsOffset(size));
+		if(endpoint.empty()) {
+			new (header) Header{{0}, {0}, {0}};
+			for(int r = 0; r < size; r++)
+				new (&pids[r]) std::atomic<pid_t>(0);
+		}
+		this->pids[rank].store(getpid(), std::memory_order_release);
+	}
+
+	~ShmAllreduce()
+	{
+		munmap(header, bytes);
+		if(rank == 0)
+			shm_unlink(name.c_str());
+	}
+
+	std::string getEndpoint() override
+	{
+		return this->name;
+	}
+
+	void setPeer(int rank, pid_t pid) override
+	{
+		this->pids[rank].store(pid, std::memory_order_release);
+	}
+
+	void connect() override
+	{
+		barrier();
+		// everyone has mapped the region, its name is no longer needed
+		if(rank == 0)
+			shm_unlink(name.c_str());
+	}
+
+	void sum(double* values, size_t count) override
+	{
+		for(size_t from = 0; from < count; from += ALLREDUCE_CHUNK) {
+			size_t n = std::min(ALLREDUCE_CHUNK, count - from);
+			std::copy(values + from, values + from + n, slots + rank * ALLREDUCE_CHUNK);
+			barrier();
+			for(size_t i = 0; i < n; i++) {
+				double total = 0.0;
+				for(int r = 0; r < size; r++)
+					total += slots[r * ALLREDUCE_CHUNK + i];
+				values[from + i] = total;
+			}
+			// the slots are rewritten by the next chunk only once everyone has read them
+			barrier();
+		}
+	}
+};
+
+class TcpAllreduce : public Allreduce
+{
+private:
+	int listener; // rank 0
+	int port;
+	std::vector<int> peers; // on rank 0 the socket of every other rank, elsewhere the one to rank 0
+	std::vector<pid_t> pids; // rank 0: the process id of every rank, 0 until known
+	std::vector<double> received;
+
+	static void sendAll(int fd, const void* data, size_t bytes)
+	{
+		const char* p = (const char*)data;
+		while(bytes > 0) {
+			ssize_t n = send(fd, p, bytes, MSG_NOSIGNAL);
+			if(n <= 0) {
+				std::cerr << "Allreduce send failed";
+				exit(1);
+			}
+			p += n;
+			bytes -= n;
+		}
+	}
+
+	static void receiveAll(int fd, void* data, size_t bytes)
+	{
+		char* p = (char*)data;
+		while(bytes > 0) {
+			ssize_t n = recv(fd, p, bytes, 0);
+			if(n <= 0) {
+				std::cerr << "Allreduce receive failed";
+				exit(1);
+			}
+			p += n;
+			bytes -= n;
+		}
+	}
+
+	static void noDelay(int fd)
+	{
+		int one = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	}
+
+public:
+	// an empty endpoint listens on a free localhost port, as rank 0 does
+	TcpAllreduce(int rank, int size, const std::string& endpoint) : Allreduce(rank, size)
+	{
+		this->listener = -1;
+		this->pids.assign(size, 0);
+		this->port = endpoint.empty() ? 0 : atoi(endpoint.c_str());
+		if(!endpoint.empty())
+			return;
+
+		sockaddr_in address = {};
+		address.sin_family = AF_INET;
+		address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		socklen_t length = sizeof(address);
+		this->listener = socket(AF_INET, SOCK_STREAM, 0);
+		if(listener < 0 || bind(listener, (sockaddr*)&address, length) != 0 || listen(listener, size) != 0
+			|| getsockname(listener, (sockaddr*)&address, &length) != 0) {
+			std::cerr << "Unable to listen on localhost";
+			exit(1);
+		}
+		this->port = ntohs(address.sin_port);
+	}
+
+	~TcpAllreduce()
+	{
+		for(int fd : peers)
+			close(fd);
+		if(listener >= 0)
+			close(listener);
+	}
+
+	std::string getEndpoint() override
+	{
+		return std::to_string(this->port);
+	}
+
+	void setPeer(int rank, pid_t pid) override
+	{
+		this->pids[rank] = pid;
+	}
+
+	void connect() override
+	{
+		if(rank == 0) {
+			// the other ranks introduce themselves in whatever order they connect
+			this->peers.assign(size, -1);
+			for(int i = 1; i < size; i++) {
+				pollfd waiting = {listener, POLLIN, 0};
+				while(poll(&waiting, 1, ALLREDUCE_CHECK_MS) == 0) {
+					for(int r = 1; r < size; r++) {
+						if(pids[r] != 0 && !alive(pids[r])) {
+							std::cerr << "Allreduce process " << r << " exited";
+							exit(1);
+						}
+					}
+				}
+
+				int fd = accept(listener, nullptr, nullptr);
+				int peer = -1;
+				if(fd < 0) {
+					std::cerr << "Unable to accept a connection";
+					exit(1);
+				}
+				receiveAll(fd, &peer, sizeof(peer));
+				if(peer < 1 || peer >= size || this->peers[peer] >= 0) {
+					std::cerr << "Allreduce connection from unexpected rank " << peer;
+					exit(1);
+				}
+				noDelay(fd);
+				this->peers[peer] = fd;
+			}
+			this->peers.erase(this->peers.begin());
+			return;
+		}
+
+		sockaddr_in address = {};
+		address.sin_family = AF_INET;
+		address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		address.sin_port = htons(port);
+		int fd = socket(AF_INET, SOCK_STREAM, 0);
+		if(fd < 0 || ::connect(fd, (sockaddr*)&address, sizeof(address)) != 0) {
+			std::cerr << "Unable to connect to port " << port;
+			exit(1);
+		}
+		noDelay(fd);
+		sendAll(fd, &rank, sizeof(rank));
+		this->peers.assign(1, fd);
+	}
+
+	void sum(double* values, size_t count) override
+	{
+		if(rank != 0) {
+			sendAll(peers[0], values, count * sizeof(double));
+			receiveAll(peers[0], values, count * sizeof(double));
+			return;
+		}
+
+		// the buffer only grows on the first call, the sums of every iteration have one size
+		if(received.size() < count)
+			received.resize(count);
+		for(int r = 1; r < size; r++) {
+			receiveAll(peers[r - 1], received.data(), count * sizeof(double));
+			for(size_t i = 0; i < count; i++)
+				values[i] += received[i];
+		}
+		for(int r = 1; r < size; r++)
+			sendAll(peers[r - 1], values, count * sizeof(double));
+	}
+};
+
+// transport is shm or tcp, endpoint is empty on rank 0
+inline std::unique_ptr<Allreduce> makeAllreduce(const std::string& transport, int rank, int size, const std::string& endpoint)
+{
+	if(transport == "tcp")
+		return std::unique_ptr<Allreduce>(new TcpAllreduce(rank, size, endpoint));
+	return std::unique_ptr<Allreduce>(new ShmAllreduce(rank, size, endpoint));
+}
+
+#endif
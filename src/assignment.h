@@ -0,0 +1,106 @@
+// Interface of the accelerated assignment engines (elkan.h, ...)
+// An engine replaces the brute force KMeans::getIDNearestCenter inside the
+// parallel point loop. It keeps its own per-point state, so nearest() may be
+// called concurrently for different points, and must return exactly the
+// center the brute force search would pick.
+
+#ifndef KMEANS_ASSIGNMENT_H
+#define KMEANS_ASSIGNMENT_H
+
+#include <cmath>
+#include <vector>
+#include <tbb/cache_aligned_allocator.h>
+
+#include "distance.h"
+#include "numa.h"
+
+// relative slack applied to every bound so rounding in the bound updates can
+// only make an engine compute a distance it could have skipped, never skip one
+// it needed
+const double BOUND_SLACK = 1e-10;
+
+class Assignment
+{
+protected:
+	int K, total_values;
+
+	// row-major copy of the centers of this and the previous iteration
+	std::vector<double, tbb::cache_aligned_allocator<double>> centers, previous;
+	// how far every center moved since the previous iteration
+	std::vector<double> shift;
+	bool first_iteration;
+
+	const double* getCenter(int id_cluster)
+	{
+		return this->centers.data() + (size_t)id_cluster * total_values;
+	}
+
+	// copy the transposed block read by the kernels (see distance.h) and measure the moves
+	void copyCenters(const double* centroids, int stride)
+	{
+		this->first_iteration = this->centers.empty();
+		this->previous.swap(this->centers);
+		this->centers.resize((size_t)K * total_values);
+
+		for(int i = 0; i < K; i++) {
+			for(int j = 0; j < total_values; j++) {
+				this->centers[(size_t)i * total_values + j] = centroids[j * stride + i];
+			}
+		}
+
+		this->shift.assign(K, 0.0);
+		if(!first_iteration) {
+			for(int i = 0; i < K; i++) {
+				const double* now = getCenter(i);
+				const double* before = this->previous.data() + (size_t)i * total_values;
+				this->shift[i] = sqrt(squaredDistance(now, before, total_values)) * (1 + BOUND_SLACK);
+			}
+		}
+	}
+
+	static double upperBound(double dist)
+	{
+		return dist * (1 + BOUND_SLACK);
+	}
+
+	static double lowerBound(double dist)
+	{
+		return dist * (1 - BOUND_SLACK);
+	}
+
+	// true when center j is at least as close as the current best and must replace it,
+	// ties go to the lower id like in the brute force search
+	static bool closer(double dist, int j, double best_dist, int best)
+	{
+		return dist < best_dist || (dist == best_dist && j < best);
+	}
+
+public:
+	Assignment(int K, int total_values)
+	{
+		this->K = K;
+		this->total_values = total_values;
+		this->first_iteration = true;
+	}
+
+	virtual ~Assignment() {}
+
+	// called once per iteration, after the centers are recalculated and before the point loop
+	virtual void update(const double* centroids, int stride) = 0;
+
+	// number of worker slots nearest() may be called with, before the first update()
+	virtual void reserveSlots(int slots) {}
+
+	// bytes of per center state read by nearest() for every point
+	virtual size_t getCenterBytes()
+	{
+		return ((size_t)K * total_values + K) * sizeof(double);
+	}
+
+	// nearest center of point index, whose current designation is id_cluster (-1 for none),
+	// from the worker slot slot; distances is increased by the number of point to center
+	// distances computed
+	virtual int nearest(int index, const double* point, int id_cluster, int slot, long& distances) = 0;
+};
+
+#endif
@@ -13,65 +13,10 @@
 #include <tbb/tbb.h>
 #include <tbb/enumerable_thread_specific.h>
 
+#include "dataset.h"
 
-using namespace std;
-
-class Point
-{
-private:
-	int id_point, id_cluster;
-	vector<double> values;
-	int total_values;
-	string name;
-
-public:
-	Point(int id_point, vector<double>& values, string name = "")
-	{
-		this->id_point = id_point;
-		total_values = values.size();
-
-		for(int i = 0; i < total_values; i++)
-			this->values.push_back(values[i]);
-
-		this->name = name;
-		this->id_cluster = -1;
-	}
-
-	int getID()
-	{
-		return this->id_point;
-	}
-
-	void setCluster(int id_cluster)
-	{
-		this->id_cluster = id_cluster;
-	}
-
-	int getCluster()
-	{
-		return this->id_cluster;
-	}
-
-	double getValue(int index)
-	{
-		return this->values[index];
-	}
-
-	int getTotalValues()
-	{
-		return total_values;
-	}
-
-	void addValue(double value)
-	{
-		this->values.push_back(value);
-	}
 
-	string getName()
-	{
-		return this->name;
-	}
-};
+using namespace std;
 
 class Cluster
 {
@@ -84,45 +29,45 @@ private:
 	
 
 public:
-	Cluster(int id_cluster, Point point)
+	Cluster(int id_cluster, const double* point, int total_values)
 	{
 		this->id_cluster = id_cluster;
 
-		total_values = point.getTotalValues();
+		this->total_values = total_values;
 		
 		this->total_points++;
 
 		for(int i = 0; i < total_values; i++) {
-			this->intermediate_central_values.push_back(point.getValue(i));
-			this->central_values.push_back(point.getValue(i));
+			this->intermediate_central_values.push_back(point[i]);
+			this->central_values.push_back(point[i]);
 		}
 	}
 
-	void addPoint(Point point) {
+	void addPoint(const double* point) {
 		this->total_points++;
 		// tbb::parallel_for(tbb::blocked_range<size_t>(0, total_values),
 		// 	[&](tbb::blocked_range<size_t>& r) {
 		// 		for(auto i = r.begin(); i != r.end(); ++i) {
-		// 			this->intermediate_central_values[i] += point.getValue(i);
+		// 			this->intermediate_central_values[i] += point[i];
 		// 		}
 		// 	}
 		// );
 		for (int i = 0; i < total_values; i++) {
-			this->intermediate_central_values[i] += point.getValue(i);
+			this->intermediate_central_values[i] += point[i];
 		}
 	}
 
-	void removePoint(Point point) {
+	void removePoint(const double* point) {
 		this->total_points--;
 		// tbb::parallel_for(tbb::blocked_range<size_t>(0, total_values),
 		// 	[&](tbb::blocked_range<size_t>& r) {
 		// 		for(auto i = r.begin(); i != r.end(); ++i) {
-		// 			this->intermediate_central_values[i] -= point.getValue(i);
+		// 			this->intermediate_central_values[i] -= point[i];
 		// 		}
 		// 	}
 		// );
 		for (int i = 0; i < total_values; i++) {
-			this->intermediate_central_values[i] -= point.getValue(i);
+			this->intermediate_central_values[i] -= point[i];
 		}
 	}
 
@@ -172,7 +117,7 @@ private:
 	vector<Cluster> clusters;
 
 	// return ID of nearest center (uses euclidean distance)
-	int getIDNearestCenter(Point point)
+	int getIDNearestCenter(const double* point)
 	{
 		double sum = 0.0, min_dist;
 		int id_cluster_center = 0;
@@ -180,7 +125,7 @@ private:
         // compute the Euclidean distance from each point to the center of the first cluster
 		for(int i = 0; i < total_values; i++)
 		{
-			sum += pow(clusters[0].getCentralValue(i) - point.getValue(i), 2.0);
+			sum += pow(clusters[0].getCentralValue(i) - point[i], 2.0);
 		}
 		min_dist = sum;
         
@@ -193,7 +138,7 @@ private:
             // compute the Euclidean distance from each point to the center of the cluster
 			for(int j = 0; j < total_values; j++)
 			{
-				sum += pow(clusters[i].getCentralValue(j) - point.getValue(j), 2.0);
+				sum += pow(clusters[i].getCentralValue(j) - point[j], 2.0);
 			}
 			dist = sum;
 
@@ -217,7 +162,7 @@ public:
 		this->max_iterations = max_iterations;
 	}
 
-	void run(vector<Point> & points)
+	void run(Dataset& dataset)
 	{
 
 		vector<std::chrono::microseconds> times1;
@@ -241,8 +186,8 @@ public:
 				if(find(prohibited_indexes.begin(), prohibited_indexes.end(), index_point) == prohibited_indexes.end())
 				{
 					prohibited_indexes.push_back(index_point);
-					points[index_point].setCluster(i);
-					Cluster cluster(i, points[index_point]);
+					dataset.setCluster(index_point, i);
+					Cluster cluster(i, dataset.getPoint(index_point), total_values);
 					clusters.push_back(cluster);
 					break;
 				}
@@ -273,8 +218,8 @@ public:
 
 			for(int i = 0; i < total_points; i++)
 			{
-				int id_old_cluster = points[i].getCluster(); // get the cluster designation of point i
-				int id_nearest_center = getIDNearestCenter(points[i]); // calculate the nearest cluster by Euclidian distance of point i
+				int id_old_cluster = dataset.getCluster(i); // get the cluster designation of point i
+				int id_nearest_center = getIDNearestCenter(dataset.getPoint(i)); // calculate the nearest cluster by Euclidian distance of point i
 				
                 // if the cluster is anything other than the nearest cluster, remove the point from the old cluster and add it to the nearest cluster
 				if(id_old_cluster != id_nearest_center)
@@ -282,10 +227,10 @@ public:
 					if(id_old_cluster != -1) // this will == -1 when the point has not been assigned a cluster 
 					{
 						// if the point has already been assigned a cluster, remove it from the old cluster
-						clusters[id_old_cluster].removePoint(points[i]);
+						clusters[id_old_cluster].removePoint(dataset.getPoint(i));
 					}
-					points[i].setCluster(id_nearest_center); // assign the point to a cluster
-					clusters[id_nearest_center].addPoint(points[i]); // add the point to the nearest cluster
+					dataset.setCluster(i, id_nearest_center); // assign the point to a cluster
+					clusters[id_nearest_center].addPoint(dataset.getPoint(i)); // add the point to the nearest cluster
                     done = false; // set done to false to continue the loop as the clusters were not finalized in successive iterations
 				}
 			}
@@ -369,51 +314,21 @@ public:
 
 int main(int argc, char *argv[])
 {
-	int total_points, total_values, K, max_iterations, has_name;
-
     string filename = argv[1];
-	ifstream inputFile(filename);
 
-	if (!inputFile) {
-		std::cerr << "Unable to open file";
+	// text or binary (see kmeans-convert)
+	Dataset dataset;
+	if (!dataset.open(filename)) {
+		std::cerr << "Unable to open " << filename << ": " << dataset.getError();
 		exit(1);
 	}
-
-	inputFile >> total_points;
-	inputFile >> total_values;
-	inputFile >> K;
-	inputFile >> max_iterations;
-	inputFile >> has_name;
-
-	vector<Point> points;
-	string point_name;
-
-	for(int i = 0; i < total_points; i++)
-	{
-		vector<double> values;
-
-		for(int j = 0; j < total_values; j++)
-		{
-			double value;
-			inputFile >> value;
-			values.push_back(value);
-		}
-
-		if(has_name)
-		{
-			inputFile >> point_name;
-			Point p(i, values, point_name);
-			points.push_back(p);
-		}
-		else
-		{
-			Point p(i, values);
-			points.push_back(p);
-		}
+	if (dataset.isSparse()) {
+		std::cerr << "Sparse datasets only work with kmeans-parallel";
+		exit(1);
 	}
 
-	KMeans kmeans(K, total_points, total_values, max_iterations);
-	kmeans.run(points);
+	KMeans kmeans(dataset.getK(), dataset.getTotalPoints(), dataset.getTotalValues(), dataset.getMaxIterations());
+	kmeans.run(dataset);
 
 	return 0;
 }
@@ -0,0 +1,939 @@
+// Contiguous storage for a k-means dataset
+// Coordinates live in one aligned row-major buffer, cluster designations in a
+// separate int32 array and point names in a side table that is only filled in
+// when the dataset header sets has_name
+//
+// A dataset is either parsed from the text format ("N D K max_iterations has_name"
+// followed by N rows, one per line, or spread over lines by the slower load()) or
+// mapped from the binary format written by kmeans-convert:
+// a DatasetHeader, the row-major matrix at values_offset and, when has_name is set,
+// a name blob at names_offset made of N + 1 uint64 offsets followed by the
+// characters of every name. A float64 matrix is used in place, straight from the
+// mapping; a float32 one is widened into the owned buffer.
+//
+// The float32 mode of kmeans-parallel reads a float32 copy of the coordinates
+// (getPointAs<float>), made by prepareSingle() or, for a float32 binary file,
+// taken in place from the mapping.
+//
+// relocate() moves the coordinates into fresh pages written by the caller's threads,
+// so that on a NUMA machine every page lands on the node of the threads that read it.
+//
+// A sparse dataset keeps only the nonzero values of every point, in CSR form: the
+// values of point i are entries[row_offsets[i], row_offsets[i + 1]), each in the
+// column of the same index of columns. getPoint() and friends do not work on it, the
+// points are read with getColumns() / getEntries() / getEntryCount() instead.
+// Its text format starts with "sparse" before the usual header and every row lists
+// "column:value" pairs (0-based columns, a point of zeros needs at least "0:0")
+// followed by the name, which must not hold a ':'. Its binary format is the binary
+// header with DATASET_SPARSE_MAGIC, followed at values_offset by the N + 1 uint64 row
+// offsets, the int32 columns and the float64 entries, each starting on a cache line.
+
+#ifndef KMEANS_DATASET_H
+#define KMEANS_DATASET_H
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <tbb/cache_aligned_allocator.h>
+#include <tbb/parallel_for.h>
+
+const char DATASET_MAGIC[8] = {'K', 'M', 'E', 'A', 'N', 'S', 'B', '\0'};
+const char DATASET_SPARSE_MAGIC[8] = {'K', 'M', 'E', 'A', 'N', 'S', 'C', '\0'};
+const uint32_t DATASET_VERSION = 1;
+// the matrix and the name blob start on a cache line
+const uint64_t DATASET_ALIGNMENT = 64;
+
+struct DatasetHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t value_size; // 8 for float64, 4 for float32
+	int64_t total_points;
+	int32_t total_values, K, max_iterations, has_name;
+	uint64_t values_offset;
+	uint64_t names_offset;
+	uint64_t names_size;
+};
+
+static_assert(sizeof(DatasetHeader) == 64, "DatasetHeader must stay 64 bytes");
+
+// the text format is read in blocks of DATASET_READ_BLOCK bytes and parsed in
+// line aligned chunks of about DATASET_PARSE_CHUNK bytes
+const size_t DATASET_READ_BLOCK = 16 << 20;
+const size_t DATASET_PARSE_CHUNK = 256 << 10;
+
+class Dataset
+{
+private:
+	int total_points, total_values, K, max_iterations, has_name;
+
+	// row-major: point i occupies values[i * total_values, (i + 1) * total_values)
+	std::vector<double, tbb::cache_aligned_allocator<double>> values;
+	std::vector<int32_t> clusters;
+	std::vector<std::string> names;
+
+	// either values.data() or the matrix inside the mapping
+	const double* data;
+
+	// float32 coordinates, either single_values.data() or the matrix inside the mapping;
+	// null until prepareSingle()
+	std::vector<float, tbb::cache_aligned_allocator<float>> single_values;
+	const float* single;
+
+	// binary datasets only
+	void* mapping;
+	size_t mapping_size;
+	const uint64_t* name_offsets;
+	const char* name_chars;
+
+	// anonymous mapping written by relocate(), holding data and, when set, single
+	void* placed;
+	size_t placed_size;
+
+	// sparse datasets only, either the owned vectors or the matrix inside the mapping
+	bool sparse;
+	std::vector<uint64_t> owned_offsets;
+	std::vector<int32_t> owned_columns;
+	std::vector<double> owned_entries;
+	const uint64_t* row_offsets;
+	const int32_t* columns;
+	const double* entries;
+	std::vector<double> norms; // squared norm of every point
+
+	std::string error; // why the last open() failed
+
+	static uint64_t alignOffset(uint64_t offset)
+	{
+		return (offset + DATASET_ALIGNMENT - 1) / DATASET_ALIGNMENT * DATASET_ALIGNMENT;
+	}
+
+	static bool isBlank(char c)
+	{
+		return c == ' ' || c == '\t' || c == '\r';
+	}
+
+	static const char* skipBlanks(const char* p, const char* end)
+	{
+		while(p < end && isBlank(*p))
+			p++;
+		return p;
+	}
+
+	// start of the line after p
+	static const char* nextLine(const char* p, const char* end)
+	{
+		const char* newline = (const char*)memchr(p, '\n', end - p);
+		return newline != nullptr ? newline + 1 : end;
+	}
+
+	// number of lines in [p, end) holding anything but blanks
+	static int countRows(const char* p, const char* end)
+	{
+		int rows = 0;
+		while(p < end) {
+			const char* line = skipBlanks(p, end);
+			if(line < end && *line != '\n')
+				rows++;
+			p = nextLine(line, end);
+		}
+		return rows;
+	}
+
+	// number of "column:value" pairs in [p, end) of the sparse text format
+	static uint64_t countEntries(const char* p, const char* end)
+	{
+		return std::count(p, end, ':');
+	}
+
+	// start of the line after the first rows rows of [p, end)
+	static const char* skipRows(const char* p, const char* end, int rows)
+	{
+		while(p < end && rows > 0) {
+			const char* line = skipBlanks(p, end);
+			if(line < end && *line != '\n')
+				rows--;
+			p = nextLine(line, end);
+		}
+		return p;
+	}
+
+	// parse the rows of [p, end) starting at row index, false on a malformed row, with p
+	// left on it
+	bool parseRows(const char*& p, const char* end, int index)
+	{
+		double* row = this->values.data() + (size_t)index * total_values;
+		while(p < end) {
+			p = skipBlanks(p, end);
+			if(p == end || *p == '\n') {
+				p = nextLine(p, end);
+				continue;
+			}
+
+			for(int j = 0; j < total_values; j++) {
+				p = skipBlanks(p, end);
+				std::from_chars_result result = std::from_chars(p, end, row[j]);
+				if(result.ec != std::errc())
+					return false;
+				p = result.ptr;
+			}
+
+			if(has_name) {
+				p = skipBlanks(p, end);
+				const char* name = p;
+				while(p < end && *p != '\n' && !isBlank(*p))
+					p++;
+				this->names[index].assign(name, p);
+			}
+
+			p = skipBlanks(p, end);
+			if(p < end && *p != '\n')
+				return false;
+			p = nextLine(p, end);
+			row += total_values;
+			index++;
+		}
+		return true;
+	}
+
+	// parse the sparse rows of [p, end) starting at row index, whose first value is
+	// entry entry, and check that they end at entry entry_end, or no later with trimmed;
+	// false on a malformed row, with p left on it
+	bool parseSparseRows(const char*& p, const char* end, int index, uint64_t entry, uint64_t entry_end, bool trimmed)
+	{
+		while(p < end) {
+			p = skipBlanks(p, end);
+			if(p == end || *p == '\n') {
+				p = nextLine(p, end);
+				continue;
+			}
+
+			// pairs until the name or the end of the line
+			while(true) {
+				p = skipBlanks(p, end);
+				int32_t column;
+				std::from_chars_result result = std::from_chars(p, end, column);
+				if(result.ec != std::errc() || result.ptr == end || *result.ptr != ':')
+					break;
+				if(column < 0 || column >= total_values || entry >= entry_end)
+					return false;
+				this->owned_columns[entry] = column;
+				result = std::from_chars(result.ptr + 1, end, this->owned_entries[entry]);
+				if(result.ec != std::errc())
+					return false;
+				p = result.ptr;
+				entry++;
+			}
+
+			if(has_name) {
+				p = skipBlanks(p, end);
+				const char* name = p;
+				while(p < end && *p != '\n' && !isBlank(*p))
+					p++;
+				this->names[index].assign(name, p);
+			}
+
+			p = skipBlanks(p, end);
+			if(p < end && *p != '\n')
+				return false;
+			p = nextLine(p, end);
+			this->owned_offsets[index + 1] = entry;
+			index++;
+		}
+		return trimmed ? entry <= entry_end : entry == entry_end;
+	}
+
+	// true if the CSR arrays of a mapped sparse dataset are consistent: the row offsets start
+	// at 0 and never decrease, and every column is below total_values, as parseSparseRows checks
+	bool checkSparse()
+	{
+		if(this->row_offsets[0] != 0)
+			return false;
+		std::atomic<bool> valid(true);
+		tbb::parallel_for(tbb::blocked_range<int>(0, total_points), [&](const tbb::blocked_range<int>& r) {
+			for(int i = r.begin(); i < r.end() && valid; i++) {
+				if(this->row_offsets[i + 1] < this->row_offsets[i]) {
+					valid = false;
+					break;
+				}
+				for(uint64_t e = this->row_offsets[i]; e < this->row_offsets[i + 1]; e++) {
+					if(this->columns[e] < 0 || this->columns[e] >= total_values) {
+						valid = false;
+						break;
+					}
+				}
+			}
+		});
+		return valid;
+	}
+
+	// true if the name offsets of a mapped dataset never decrease and stay within the chars
+	// characters that follow them
+	bool checkNames(uint64_t chars)
+	{
+		if(this->name_offsets[total_points] > chars)
+			return false;
+		std::atomic<bool> valid(true);
+		tbb::parallel_for(tbb::blocked_range<int>(0, total_points), [&](const tbb::blocked_range<int>& r) {
+			for(int i = r.begin(); i < r.end(); i++) {
+				if(this->name_offsets[i + 1] < this->name_offsets[i]) {
+					valid = false;
+					break;
+				}
+			}
+		});
+		return valid;
+	}
+
+	// squared norm of every sparse point, read by the sparse kernel
+	void computeNorms()
+	{
+		this->norms.resize(total_points);
+		tbb::parallel_for(tbb::blocked_range<int>(0, total_points), [&](const tbb::blocked_range<int>& r) {
+			for(int i = r.begin(); i < r.end(); i++) {
+				double norm = 0.0;
+				for(uint64_t e = this->row_offsets[i]; e < this->row_offsets[i + 1]; e++)
+					norm += this->entries[e] * this->entries[e];
+				this->norms[i] = norm;
+			}
+		});
+	}
+
+	void unmap()
+	{
+		if(this->mapping != nullptr)
+			munmap(this->mapping, this->mapping_size);
+		if(this->placed != nullptr)
+			munmap(this->placed, this->placed_size);
+		this->mapping = nullptr;
+		this->mapping_size = 0;
+		this->name_offsets = nullptr;
+		this->name_chars = nullptr;
+		this->placed = nullptr;
+		this->placed_size = 0;
+		this->single = nullptr;
+		this->single_values.clear();
+		this->sparse = false;
+		this->owned_offsets.clear();
+		this->owned_columns.clear();
+		this->owned_entries.clear();
+		this->row_offsets = nullptr;
+		this->columns = nullptr;
+		this->entries = nullptr;
+		this->norms.clear();
+	}
+
+public:
+	Dataset()
+	{
+		this->total_points = 0;
+		this->total_values = 0;
+		this->K = 0;
+		this->max_iterations = 0;
+		this->has_name = 0;
+		this->data = nullptr;
+		this->single = nullptr;
+		this->mapping = nullptr;
+		this->mapping_size = 0;
+		this->name_offsets = nullptr;
+		this->name_chars = nullptr;
+		this->placed = nullptr;
+		this->placed_size = 0;
+		this->sparse = false;
+		this->row_offsets = nullptr;
+		this->columns = nullptr;
+		this->entries = nullptr;
+	}
+
+	Dataset(const Dataset&) = delete;
+	Dataset& operator=(const Dataset&) = delete;
+
+	~Dataset()
+	{
+		unmap();
+	}
+
+	// load a text or binary dataset, told apart by the magic of the binary header; on
+	// failure getError() tells why
+	bool open(const std::string& filename)
+	{
+		std::ifstream input(filename, std::ios::binary);
+		if(!input) {
+			this->error = "cannot be read";
+			return false;
+		}
+
+		char magic[sizeof(DATASET_MAGIC)] = {};
+		input.read(magic, sizeof(magic));
+		if(input.gcount() == sizeof(magic) && (memcmp(magic, DATASET_MAGIC, sizeof(magic)) == 0
+			|| memcmp(magic, DATASET_SPARSE_MAGIC, sizeof(magic)) == 0))
+			return map(filename);
+
+		input.close();
+		if(parse(filename))
+			return true;
+		if(this->sparse)
+			return false;
+
+		// a dense row spread over several lines only fails the line based parser
+		std::string error = this->error;
+		std::ifstream text(filename);
+		if(load(text))
+			return true;
+		this->error = error;
+		return false;
+	}
+
+	// read a text dataset in large blocks and parse it in parallel, straight into the
+	// row-major buffer or the CSR arrays; unlike load() it needs every row on a line of its own
+	bool parse(const std::string& filename)
+	{
+		unmap();
+
+		this->error = "cannot be read";
+		int fd = ::open(filename.c_str(), O_RDONLY);
+		if(fd < 0)
+			return false;
+
+		struct stat info;
+		if(fstat(fd, &info) != 0) {
+			close(fd);
+			return false;
+		}
+
+		std::vector<char> text(info.st_size);
+		size_t size = 0;
+		while(size < text.size()) {
+			ssize_t count = read(fd, text.data() + size, std::min(DATASET_READ_BLOCK, text.size() - size));
+			if(count <= 0)
+				break;
+			size += count;
+		}
+		close(fd);
+		if(size < text.size())
+			return false;
+
+		// header, after "sparse" for the sparse format
+		const char* p = text.data();
+		const char* end = p + size;
+		while(p < end && (isBlank(*p) || *p == '\n'))
+			p++;
+		this->sparse = end - p >= 6 && memcmp(p, "sparse", 6) == 0;
+		if(sparse)
+			p += 6;
+		int* header[] = {&total_points, &total_values, &K, &max_iterations, &has_name};
+		for(int* field : header) {
+			while(p < end && (isBlank(*p) || *p == '\n'))
+				p++;
+			std::from_chars_result result = std::from_chars(p, end, *field);
+			if(result.ec != std::errc()) {
+				this->error = "malformed header";
+				return false;
+			}
+			p = result.ptr;
+		}
+		if(total_points < 0 || total_values < 1) {
+			this->error = "malformed header";
+			return false;
+		}
+		p = nextLine(p, end);
+
+		// split the rows into line aligned chunks and find the first row of every chunk
+		std::vector<const char*> chunks;
+		while(p < end) {
+			chunks.push_back(p);
+			p = nextLine(std::min(p + DATASET_PARSE_CHUNK, end), end);
+		}
+		chunks.push_back(end);
+
+		size_t total_chunks = chunks.size() - 1;
+		std::vector<int> first_row(total_chunks + 1, 0);
+		std::vector<uint64_t> first_entry(total_chunks + 1, 0);
+		tbb::parallel_for(size_t(0), total_chunks, [&](size_t c) {
+			first_row[c + 1] = countRows(chunks[c], chunks[c + 1]);
+			if(sparse)
+				first_entry[c + 1] = countEntries(chunks[c], chunks[c + 1]);
+		});
+		for(size_t c = 0; c < total_chunks; c++) {
+			first_row[c + 1] += first_row[c];
+			first_entry[c + 1] += first_entry[c];
+		}
+		if(first_row[total_chunks] < total_points) {
+			this->error = "holds " + std::to_string(first_row[total_chunks]) + " rows out of " + std::to_string(total_points);
+			return false;
+		}
+
+		this->clusters.assign(total_points, -1);
+		this->names.clear();
+		if(has_name)
+			this->names.resize(total_points);
+		if(sparse) {
+			this->owned_offsets.assign(total_points + 1, 0);
+			this->owned_columns.resize(first_entry[total_chunks]);
+			this->owned_entries.resize(first_entry[total_chunks]);
+			this->row_offsets = this->owned_offsets.data();
+			this->columns = this->owned_columns.data();
+			this->entries = this->owned_entries.data();
+			this->data = nullptr;
+		} else {
+			this->values.resize((size_t)total_points * total_values);
+			this->data = this->values.data();
+		}
+
+		// rows past total_points are ignored, like load() does; every chunk keeps where
+		// it failed, so that the first malformed row of the file is the one reported
+		std::vector<const char*> failed(total_chunks, nullptr);
+		tbb::parallel_for(size_t(0), total_chunks, [&](size_t c) {
+			if(first_row[c] >= total_points)
+				return;
+			const char* p = chunks[c];
+			const char* chunk_end = chunks[c + 1];
+			bool trimmed = first_row[c + 1] > total_points;
+			if(trimmed)
+				chunk_end = skipRows(p, chunk_end, total_points - first_row[c]);
+			bool parsed = sparse
+				? parseSparseRows(p, chunk_end, first_row[c], first_entry[c], first_entry[c + 1], trimmed)
+				: parseRows(p, chunk_end, first_row[c]);
+			if(!parsed)
+				failed[c] = std::min(p, chunk_end - 1);
+		});
+
+		for(const char* at : failed) {
+			if(at != nullptr) {
+				this->error = "malformed row at line " + std::to_string(1 + std::count((const char*)text.data(), at, '\n'));
+				return false;
+			}
+		}
+
+		if(sparse)
+			computeNorms();
+		this->error.clear();
+		return true;
+	}
+
+	// map a binary dataset written by save()
+	bool map(const std::string& filename)
+	{
+		unmap();
+
+		this->error = "malformed binary dataset";
+		int fd = ::open(filename.c_str(), O_RDONLY);
+		if(fd < 0)
+			return false;
+
+		struct stat info;
+		if(fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(DatasetHeader)) {
+			close(fd);
+			return false;
+		}
+
+		void* mapping = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if(mapping == MAP_FAILED)
+			return false;
+		this->mapping = mapping;
+		this->mapping_size = info.st_size;
+
+		const char* base = (const char*)mapping;
+		DatasetHeader header;
+		memcpy(&header, base, sizeof(header));
+
+		// the counts are checked before any size is derived from them, and the sizes are
+		// compared with what is left of the mapping, so that none of them wraps
+		bool counts = header.total_points >= 0 && header.total_points <= INT_MAX && header.total_values >= 1
+			&& header.values_offset <= this->mapping_size;
+		uint64_t available = counts ? this->mapping_size - header.values_offset : 0;
+		uint64_t row_size = counts ? (uint64_t)header.total_values * header.value_size : 0;
+		uint64_t names_table = counts ? ((uint64_t)header.total_points + 1) * sizeof(uint64_t) : 0;
+
+		// for a sparse dataset, where the columns and the entries start
+		bool sparse = memcmp(header.magic, DATASET_SPARSE_MAGIC, sizeof(DATASET_SPARSE_MAGIC)) == 0;
+		uint64_t columns_offset = 0, entries_offset = 0, total_entries = 0;
+		uint64_t values_size = UINT64_MAX; // until it is known to fit
+		if(counts && !sparse && (header.total_points == 0 || row_size <= available / header.total_points))
+			values_size = header.total_points * row_size;
+		if(counts && sparse) {
+			values_size = (header.total_points + 1) * sizeof(uint64_t);
+			if(values_size <= available)
+				total_entries = ((const uint64_t*)(base + header.values_offset))[header.total_points];
+			// a larger count would wrap the sizes below, it cannot fit anyway
+			if(total_entries > this->mapping_size) {
+				unmap();
+				return false;
+			}
+			columns_offset = alignOffset(header.values_offset + values_size);
+			entries_offset = alignOffset(columns_offset + total_entries * sizeof(int32_t));
+			values_size = entries_offset + total_entries * sizeof(double) - header.values_offset;
+		}
+		if((!sparse && memcmp(header.magic, DATASET_MAGIC, sizeof(DATASET_MAGIC)) != 0) || header.version != DATASET_VERSION
+			|| !counts || (sparse && header.value_size != 8)
+			|| (header.value_size != 8 && header.value_size != 4) || header.values_offset % DATASET_ALIGNMENT != 0
+			|| values_size > available
+			|| (header.has_name && (header.names_offset % DATASET_ALIGNMENT != 0 || header.names_offset > this->mapping_size
+				|| header.names_size > this->mapping_size - header.names_offset || header.names_size < names_table))) {
+			unmap();
+			return false;
+		}
+
+		this->total_points = header.total_points;
+		this->total_values = header.total_values;
+		this->K = header.K;
+		this->max_iterations = header.max_iterations;
+		this->has_name = header.has_name;
+		this->clusters.assign(total_points, -1);
+		this->names.clear();
+
+		size_t count = (size_t)total_points * total_values;
+		if(sparse) {
+			this->sparse = true;
+			this->row_offsets = (const uint64_t*)(base + header.values_offset);
+			this->columns = (const int32_t*)(base + columns_offset);
+			this->entries = (const double*)(base + entries_offset);
+			this->data = nullptr;
+			if(!checkSparse()) {
+				unmap();
+				return false;
+			}
+			computeNorms();
+		} else if(header.value_size == 8) {
+			this->values.clear();
+			this->data = (const double*)(base + header.values_offset);
+		} else {
+			const float* matrix = (const float*)(base + header.values_offset);
+			this->values.assign(matrix, matrix + count);
+			this->data = this->values.data();
+			this->single = matrix;
+		}
+
+		if(has_name) {
+			this->name_offsets = (const uint64_t*)(base + header.names_offset);
+			this->name_chars = (const char*)(this->name_offsets + total_points + 1);
+			if(!checkNames(header.names_size - names_table)) {
+				unmap();
+				return false;
+			}
+		}
+
+		// the rows are read in order by the first passes
+		madvise(mapping, this->mapping_size, MADV_SEQUENTIAL);
+		this->error.clear();
+		return true;
+	}
+
+	// write the binary format, with a float32 matrix when single is set; a sparse dataset is
+	// always written in the sparse binary format, single does not apply to it
+	bool save(std::ostream& output, bool single = false)
+	{
+		DatasetHeader header = {};
+		memcpy(header.magic, sparse ? DATASET_SPARSE_MAGIC : DATASET_MAGIC, sizeof(DATASET_MAGIC));
+		header.version = DATASET_VERSION;
+		header.value_size = single && !sparse ? 4 : 8;
+		header.total_points = total_points;
+		header.total_values = total_values;
+		header.K = K;
+		header.max_iterations = max_iterations;
+		header.has_name = has_name;
+		header.values_offset = alignOffset(sizeof(DatasetHeader));
+
+		uint64_t values_end = header.values_offset + (uint64_t)total_points * total_values * header.value_size;
+		uint64_t columns_offset = 0, entries_offset = 0;
+		if(sparse) {
+			columns_offset = alignOffset(header.values_offset + (total_points + 1) * sizeof(uint64_t));
+			entries_offset = alignOffset(columns_offset + getTotalEntries() * sizeof(int32_t));
+			values_end = entries_offset + getTotalEntries() * sizeof(double);
+		}
+		std::vector<uint64_t> offsets;
+		if(has_name) {
+			offsets.push_back(0);
+			for(int i = 0; i < total_points; i++)
+				offsets.push_back(offsets.back() + getName(i).size());
+			header.names_offset = alignOffset(values_end);
+			header.names_size = offsets.size() * sizeof(uint64_t) + offsets.back();
+		}
+
+		std::vector<char> padding(DATASET_ALIGNMENT, 0);
+		output.write((const char*)&header, sizeof(header));
+		output.write(padding.data(), header.values_offset - sizeof(header));
+
+		size_t count = (size_t)total_points * total_values;
+		if(sparse) {
+			output.write((const char*)this->row_offsets, (total_points + 1) * sizeof(uint64_t));
+			output.write(padding.data(), columns_offset - header.values_offset - (total_points + 1) * sizeof(uint64_t));
+			output.write((const char*)this->columns, getTotalEntries() * sizeof(int32_t));
+			output.write(padding.data(), entries_offset - columns_offset - getTotalEntries() * sizeof(int32_t));
+			output.write((const char*)this->entries, getTotalEntries() * sizeof(double));
+		} else if(single) {
+			std::vector<float> matrix(this->data, this->data + count);
+			output.write((const char*)matrix.data(), count * sizeof(float));
+		} else {
+			output.write((const char*)this->data, count * sizeof(double));
+		}
+
+		if(has_name) {
+			output.write(padding.data(), header.names_offset - values_end);
+			output.write((const char*)offsets.data(), offsets.size() * sizeof(uint64_t));
+			for(int i = 0; i < total_points; i++) {
+				std::string name = getName(i);
+				output.write(name.data(), name.size());
+			}
+		}
+
+		return !output.fail();
+	}
+
+	// read the "N D K max_iterations has_name" header followed by N dense rows, as whitespace
+	// separated values, so that a row may span several lines; open() falls back to it when
+	// parse() fails
+	bool load(std::istream& input)
+	{
+		unmap();
+		if(!(input >> total_points >> total_values >> K >> max_iterations >> has_name) || total_points < 0 || total_values < 1)
+			return false;
+
+		this->values.resize((size_t)total_points * total_values);
+		this->clusters.assign(total_points, -1);
+		this->names.clear();
+		if(has_name)
+			this->names.resize(total_points);
+		this->data = this->values.data();
+
+		double* row = this->values.data();
+		for(int i = 0; i < total_points; i++)
+		{
+			for(int j = 0; j < total_values; j++)
+				input >> row[j];
+			row += total_values;
+
+			if(has_name)
+				input >> this->names[i];
+		}
+
+		if(input.fail())
+			return false;
+		this->error.clear();
+		return true;
+	}
+
+	// turn a dense dataset into a sparse one holding its nonzero values
+	void sparsify()
+	{
+		if(sparse)
+			return;
+
+		this->owned_offsets.assign(total_points + 1, 0);
+		this->owned_columns.clear();
+		this->owned_entries.clear();
+		for(int i = 0; i < total_points; i++) {
+			const double* point = getPoint(i);
+			for(int j = 0; j < total_values; j++) {
+				if(point[j] != 0.0) {
+					this->owned_columns.push_back(j);
+					this->owned_entries.push_back(point[j]);
+				}
+			}
+			this->owned_offsets[i + 1] = this->owned_entries.size();
+		}
+
+		// names are copied out of the mapping, which goes with the dense matrix
+		if(has_name && this->name_offsets != nullptr) {
+			this->names.resize(total_points);
+			for(int i = 0; i < total_points; i++)
+				this->names[i] = getName(i);
+		}
+		std::vector<uint64_t> offsets = std::move(this->owned_offsets);
+		std::vector<int32_t> columns = std::move(this->owned_columns);
+		std::vector<double> entries = std::move(this->owned_entries);
+		std::vector<std::string> names = std::move(this->names);
+		unmap();
+		this->values.clear();
+		this->values.shrink_to_fit();
+		this->owned_offsets = std::move(offsets);
+		this->owned_columns = std::move(columns);
+		this->owned_entries = std::move(entries);
+		this->names = std::move(names);
+		this->sparse = true;
+		this->row_offsets = this->owned_offsets.data();
+		this->columns = this->owned_columns.data();
+		this->entries = this->owned_entries.data();
+		this->data = nullptr;
+		computeNorms();
+	}
+
+	// make the float32 coordinates read by getPointAs<float>
+	void prepareSingle()
+	{
+		if(this->single != nullptr)
+			return;
+
+		size_t count = (size_t)total_points * total_values;
+		this->single_values.resize(count);
+		tbb::parallel_for(tbb::blocked_range<size_t>(0, count), [&](const tbb::blocked_range<size_t>& r) {
+			for(size_t i = r.begin(); i < r.end(); i++)
+				this->single_values[i] = (float)this->data[i];
+		});
+		this->single = this->single_values.data();
+	}
+
+	// Move the coordinates, and the float32 copy if there is one, into new pages that
+	// nothing has touched yet. place(copy) must call copy(begin, end) once for every point
+	// of [0, total_points), each from a thread running where those points will be read:
+	// the kernel puts a page on the NUMA node of the thread that first writes it.
+	// False if the pages could not be mapped, the dataset is left as it was
+	template<typename Place>
+	bool relocate(Place place)
+	{
+		size_t count = (size_t)total_points * total_values;
+		size_t single_offset = alignOffset(count * sizeof(double));
+		size_t size = single_offset + (this->single != nullptr ? count * sizeof(float) : 0);
+		void* region = mmap(nullptr, std::max(size, (size_t)1), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if(region == MAP_FAILED)
+			return false;
+
+		double* moved = (double*)region;
+		float* moved_single = this->single != nullptr ? (float*)((char*)region + single_offset) : nullptr;
+		auto copy = [&](int begin, int end) {
+			size_t from = (size_t)begin * total_values, to = (size_t)end * total_values;
+			std::copy(this->data + from, this->data + to, moved + from);
+			if(moved_single != nullptr)
+				std::copy(this->single + from, this->single + to, moved_single + from);
+		};
+		place(copy);
+
+		// the binary mapping stays for the names
+		if(this->placed != nullptr)
+			munmap(this->placed, this->placed_size);
+		this->values.clear();
+		this->values.shrink_to_fit();
+		this->single_values.clear();
+		this->single_values.shrink_to_fit();
+		this->placed = region;
+		this->placed_size = std::max(size, (size_t)1);
+		this->data = moved;
+		this->single = moved_single;
+		return true;
+	}
+
+	int getTotalPoints()
+	{
+		return this->total_points;
+	}
+
+	int getTotalValues()
+	{
+		return this->total_values;
+	}
+
+	int getK()
+	{
+		return this->K;
+	}
+
+	int getMaxIterations()
+	{
+		return this->max_iterations;
+	}
+
+	bool hasName()
+	{
+		return this->has_name;
+	}
+
+	const double* getPoint(int index)
+	{
+		return this->data + (size_t)index * total_values;
+	}
+
+	// point index with T = double, or from the prepareSingle() copy with T = float
+	template<typename T>
+	const T* getPointAs(int index)
+	{
+		if constexpr (std::is_same<T, float>::value)
+			return this->single + (size_t)index * total_values;
+		else
+			return getPoint(index);
+	}
+
+	double getValue(int index, int value)
+	{
+		return this->data[(size_t)index * total_values + value];
+	}
+
+	bool isSparse()
+	{
+		return this->sparse;
+	}
+
+	uint64_t getTotalEntries()
+	{
+		return this->sparse ? this->row_offsets[total_points] : (uint64_t)total_points * total_values;
+	}
+
+	// nonzero values of sparse point index and their columns
+	int getEntryCount(int index)
+	{
+		return this->row_offsets[index + 1] - this->row_offsets[index];
+	}
+
+	const int32_t* getColumns(int index)
+	{
+		return this->columns + this->row_offsets[index];
+	}
+
+	const double* getEntries(int index)
+	{
+		return this->entries + this->row_offsets[index];
+	}
+
+	// squared norm of sparse point index
+	double getNorm(int index)
+	{
+		return this->norms[index];
+	}
+
+	// write the total_values coordinates of sparse point index into point
+	void densify(int index, double* point)
+	{
+		std::fill(point, point + total_values, 0.0);
+		for(uint64_t e = this->row_offsets[index]; e < this->row_offsets[index + 1]; e++)
+			point[this->columns[e]] = this->entries[e];
+	}
+
+	int getCluster(int index)
+	{
+		return this->clusters[index];
+	}
+
+	void setCluster(int index, int id_cluster)
+	{
+		this->clusters[index] = id_cluster;
+	}
+
+	// why the last open() failed: "malformed row at line 12", ...
+	std::string getError()
+	{
+		return this->error;
+	}
+
+	std::string getName(int index)
+	{
+		if(!has_name)
+			return "";
+		if(this->name_offsets != nullptr)
+			return std::string(this->name_chars + this->name_offsets[index], this->name_offsets[index + 1] - this->name_offsets[index]);
+		return this->names[index];
+	}
+};
+
+#endif
@@ -0,0 +1,369 @@
+// Nearest center kernels
+// The centroids are kept transposed so a kernel can compare one point against
+// a block of centroids at once: value j of centroid k sits at
+// centroids[j * stride + k], where stride is K rounded up to a cache line worth
+// of values (centroidStride) and the padding columns hold +infinity so they can
+// never be the nearest center.
+//
+// Every kernel adds up the squared differences in the same order as the scalar
+// loop and keeps the first center with the smallest distance, so they all pick
+// the same labels. Kernels exist for float64 and float32 coordinates, the
+// float32 ones compare twice as many centers per instruction.
+
+#ifndef KMEANS_DISTANCE_H
+#define KMEANS_DISTANCE_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <immintrin.h>
+
+// bytes of a block of centroid columns, the widest vector the kernels load
+const int CENTROID_BLOCK_BYTES = 64;
+
+template<typename T>
+using NearestCenterKernel = int (*)(const T* point, const T* centroids, int K, int stride, int total_values);
+
+typedef NearestCenterKernel<double> NearestCenterFn;
+
+template<typename T = double>
+int centroidStride(int K)
+{
+	const int block = CENTROID_BLOCK_BYTES / sizeof(T);
+	return (K + block - 1) / block * block;
+}
+
+// squared distance between a point and one row-major center, summed in the same
+// order as the kernels below so the engines in elkan.h and friends agree with them
+inline double squaredDistance(const double* point, const double* center, int total_values)
+{
+	double sum = 0.0;
+	for(int j = 0; j < total_values; j++)
+	{
+		double diff = center[j] - point[j];
+		sum += diff * diff;
+	}
+	return sum;
+}
+
+// D is the number of values of a point when known at compile time, or 0 to use total_values
+template<int D, typename T>
+int nearestCenterScalar(const T* point, const T* centroids, int K, int stride, int total_values)
+{
+	const int dims = D ? D : total_values;
+	T min_dist = 0;
+	int id_cluster_center = 0;
+
+	for(int j = 0; j < dims; j++)
+	{
+		T diff = centroids[j * stride] - point[j];
+		min_dist += diff * diff;
+	}
+
+	for(int i = 1; i < K; i++)
+	{
+		T dist = 0;
+
+		for(int j = 0; j < dims; j++)
+		{
+			T diff = centroids[j * stride + i] - point[j];
+			dist += diff * diff;
+		}
+
+		if(dist < min_dist)
+		{
+			min_dist = dist;
+			id_cluster_center = i;
+		}
+	}
+
+	return id_cluster_center;
+}
+
+// Horizontal minimum of a vector. A kernel ends with the nearest center of every lane
+// and picks the smallest id among the lanes holding the smallest distance, without a
+// branch per lane.
+__attribute__((target("sse4.2")))
+inline __m128d minLanes(__m128d v)
+{
+	return _mm_min_pd(v, _mm_shuffle_pd(v, v, 1));
+}
+
+__attribute__((target("sse4.2")))
+inline __m128 minLanes(__m128 v)
+{
+	v = _mm_min_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 0, 3, 2)));
+	return _mm_min_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1)));
+}
+
+__attribute__((target("avx2")))
+inline __m256d minLanes(__m256d v)
+{
+	v = _mm256_min_pd(v, _mm256_permute2f128_pd(v, v, 1));
+	return _mm256_min_pd(v, _mm256_shuffle_pd(v, v, 5));
+}
+
+__attribute__((target("avx2")))
+inline __m256 minLanes(__m256 v)
+{
+	v = _mm256_min_ps(v, _mm256_permute2f128_ps(v, v, 1));
+	v = _mm256_min_ps(v, _mm256_shuffle_ps(v, v, _MM_SHUFFLE(1, 0, 3, 2)));
+	return _mm256_min_ps(v, _mm256_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1)));
+}
+
+template<int D>
+__attribute__((target("sse4.2")))
+int nearestCenterSSE(const double* point, const double* centroids, int K, int stride, int total_values)
+{
+	const int dims = D ? D : total_values;
+	__m128d min_dist = _mm_set1_pd(INFINITY);
+	__m128d min_id = _mm_setzero_pd();
+	__m128d id = _mm_set_pd(1.0, 0.0);
+	const __m128d step = _mm_set1_pd(2.0);
+
+	for(int i = 0; i < K; i += 2)
+	{
+		__m128d dist = _mm_setzero_pd();
+		for(int j = 0; j < dims; j++)
+		{
+			__m128d diff = _mm_sub_pd(_mm_load_pd(centroids + j * stride + i), _mm_set1_pd(point[j]));
+			dist = _mm_add_pd(dist, _mm_mul_pd(diff, diff));
+		}
+		__m128d closer = _mm_cmplt_pd(dist, min_dist);
+		min_dist = _mm_blendv_pd(min_dist, dist, closer);
+		min_id = _mm_blendv_pd(min_id, id, closer);
+		id = _mm_add_pd(id, step);
+	}
+
+	__m128d lanes = _mm_cmpeq_pd(min_dist, minLanes(min_dist));
+	return (int)_mm_cvtsd_f64(minLanes(_mm_blendv_pd(_mm_set1_pd(INFINITY), min_id, lanes)));
+}
+
+template<int D>
+__attribute__((target("avx2")))
+int nearestCenterAVX2(const double* point, const double* centroids, int K, int stride, int total_values)
+{
+	const int dims = D ? D : total_values;
+	__m256d min_dist = _mm256_set1_pd(INFINITY);
+	__m256d min_id = _mm256_setzero_pd();
+	__m256d id = _mm256_set_pd(3.0, 2.0, 1.0, 0.0);
+	const __m256d step = _mm256_set1_pd(4.0);
+
+	for(int i = 0; i < K; i += 4)
+	{
+		__m256d dist = _mm256_setzero_pd();
+		for(int j = 0; j < dims; j++)
+		{
+			__m256d diff = _mm256_sub_pd(_mm256_load_pd(centroids + j * stride + i), _mm256_set1_pd(point[j]));
+			dist = _mm256_add_pd(dist, _mm256_mul_pd(diff, diff));
+		}
+		__m256d closer = _mm256_cmp_pd(dist, min_dist, _CMP_LT_OQ);
+		min_dist = _mm256_blendv_pd(min_dist, dist, closer);
+		min_id = _mm256_blendv_pd(min_id, id, closer);
+		id = _mm256_add_pd(id, step);
+	}
+
+	__m256d lanes = _mm256_cmp_pd(min_dist, minLanes(min_dist), _CMP_EQ_OQ);
+	return (int)_mm256_cvtsd_f64(minLanes(_mm256_blendv_pd(_mm256_set1_pd(INFINITY), min_id, lanes)));
+}
+
+template<int D>
+__attribute__((target("avx512f")))
+int nearestCenterAVX512(const double* point, const double* centroids, int K, int stride, int total_values)
+{
+	const int dims = D ? D : total_values;
+	__m512d min_dist = _mm512_set1_pd(INFINITY);
+	__m512d min_id = _mm512_setzero_pd();
+	__m512d id = _mm512_set_pd(7.0, 6.0, 5.0, 4.0, 3.0, 2.0, 1.0, 0.0);
+	const __m512d step = _mm512_set1_pd(8.0);
+
+	for(int i = 0; i < K; i += 8)
+	{
+		__m512d dist = _mm512_setzero_pd();
+		for(int j = 0; j < dims; j++)
+		{
+			__m512d diff = _mm512_sub_pd(_mm512_load_pd(centroids + j * stride + i), _mm512_set1_pd(point[j]));
+			dist = _mm512_add_pd(dist, _mm512_mul_pd(diff, diff));
+		}
+		__mmask8 closer = _mm512_cmp_pd_mask(dist, min_dist, _CMP_LT_OQ);
+		min_dist = _mm512_mask_mov_pd(min_dist, closer, dist);
+		min_id = _mm512_mask_mov_pd(min_id, closer, id);
+		id = _mm512_add_pd(id, step);
+	}
+
+	__mmask8 lanes = _mm512_cmp_pd_mask(min_dist, _mm512_set1_pd(_mm512_reduce_min_pd(min_dist)), _CMP_EQ_OQ);
+	return (int)_mm512_reduce_min_pd(_mm512_mask_mov_pd(_mm512_set1_pd(INFINITY), lanes, min_id));
+}
+
+// float32 versions, the lane ids stay exact as floats up to 2^24 centers
+
+template<int D>
+__attribute__((target("sse4.2")))
+int nearestCenterSSE(const float* point, const float* centroids, int K, int stride, int total_values)
+{
+	const int dims = D ? D : total_values;
+	__m128 min_dist = _mm_set1_ps(INFINITY);
+	__m128 min_id = _mm_setzero_ps();
+	__m128 id = _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f);
+	const __m128 step = _mm_set1_ps(4.0f);
+
+	for(int i = 0; i < K; i += 4)
+	{
+		__m128 dist = _mm_setzero_ps();
+		for(int j = 0; j < dims; j++)
+		{
+			__m128 diff = _mm_sub_ps(_mm_load_ps(centroids + j * stride + i), _mm_set1_ps(point[j]));
+			dist = _mm_add_ps(dist, _mm_mul_ps(diff, diff));
+		}
+		__m128 closer = _mm_cmplt_ps(dist, min_dist);
+		min_dist = _mm_blendv_ps(min_dist, dist, closer);
+		min_id = _mm_blendv_ps(min_id, id, closer);
+		id = _mm_add_ps(id, step);
+	}
+
+	__m128 lanes = _mm_cmpeq_ps(min_dist, minLanes(min_dist));
+	return (int)_mm_cvtss_f32(minLanes(_mm_blendv_ps(_mm_set1_ps(INFINITY), min_id, lanes)));
+}
+
+template<int D>
+__attribute__((target("avx2")))
+int nearestCenterAVX2(const float* point, const float* centroids, int K, int stride, int total_values)
+{
+	const int dims = D ? D : total_values;
+	__m256 min_dist = _mm256_set1_ps(INFINITY);
+	__m256 min_id = _mm256_setzero_ps();
+	__m256 id = _mm256_set_ps(7.0f, 6.0f, 5.0f, 4.0f, 3.0f, 2.0f, 1.0f, 0.0f);
+	const __m256 step = _mm256_set1_ps(8.0f);
+
+	for(int i = 0; i < K; i += 8)
+	{
+		__m256 dist = _mm256_setzero_ps();
+		for(int j = 0; j < dims; j++)
+		{
+			__m256 diff = _mm256_sub_ps(_mm256_load_ps(centroids + j * stride + i), _mm256_set1_ps(point[j]));
+			dist = _mm256_add_ps(dist, _mm256_mul_ps(diff, diff));
+		}
+		__m256 closer = _mm256_cmp_ps(dist, min_dist, _CMP_LT_OQ);
+		min_dist = _mm256_blendv_ps(min_dist, dist, closer);
+		min_id = _mm256_blendv_ps(min_id, id, closer);
+		id = _mm256_add_ps(id, step);
+	}
+
+	__m256 lanes = _mm256_cmp_ps(min_dist, minLanes(min_dist), _CMP_EQ_OQ);
+	return (int)_mm256_cvtss_f32(minLanes(_mm256_blendv_ps(_mm256_set1_ps(INFINITY), min_id, lanes)));
+}
+
+template<int D>
+__attribute__((target("avx512f")))
+int nearestCenterAVX512(const float* point, const float* centroids, int K, int stride, int total_values)
+{
+	const int dims = D ? D : total_values;
+	__m512 min_dist = _mm512_set1_ps(INFINITY);
+	__m512 min_id = _mm512_setzero_ps();
+	__m512 id = _mm512_set_ps(15.0f, 14.0f, 13.0f, 12.0f, 11.0f, 10.0f, 9.0f, 8.0f, 7.0f, 6.0f, 5.0f, 4.0f, 3.0f, 2.0f, 1.0f, 0.0f);
+	const __m512 step = _mm512_set1_ps(16.0f);
+
+	for(int i = 0; i < K; i += 16)
+	{
+		__m512 dist = _mm512_setzero_ps();
+		for(int j = 0; j < dims; j++)
+		{
+			__m512 diff = _mm512_sub_ps(_mm512_load_ps(centroids + j * stride + i), _mm512_set1_ps(point[j]));
+			dist = _mm512_add_ps(dist, _mm512_mul_ps(diff, diff));
+		}
+		__mmask16 closer = _mm512_cmp_ps_mask(dist, min_dist, _CMP_LT_OQ);
+		min_dist = _mm512_mask_mov_ps(min_dist, closer, dist);
+		min_id = _mm512_mask_mov_ps(min_id, closer, id);
+		id = _mm512_add_ps(id, step);
+	}
+
+	__mmask16 lanes = _mm512_cmp_ps_mask(min_dist, _mm512_set1_ps(_mm512_reduce_min_ps(min_dist)), _CMP_EQ_OQ);
+	return (int)_mm512_reduce_min_ps(_mm512_mask_mov_ps(_mm512_set1_ps(INFINITY), lanes, min_id));
+}
+
+// one row per instruction set, one column per specialized dimension plus the runtime sized kernel
+template<template<int, typename> class Kernel, typename T>
+NearestCenterKernel<T> selectDimension(int total_values)
+{
+	switch(total_values)
+	{
+		case 2: return Kernel<2, T>::fn;
+		case 3: return Kernel<3, T>::fn;
+		case 4: return Kernel<4, T>::fn;
+		case 7: return Kernel<7, T>::fn;
+		case 8: return Kernel<8, T>::fn;
+		case 16: return Kernel<16, T>::fn;
+		default: return Kernel<0, T>::fn;
+	}
+}
+
+template<int D, typename T> struct ScalarKernel { static constexpr NearestCenterKernel<T> fn = nearestCenterScalar<D, T>; };
+template<int D, typename T> struct SSEKernel { static constexpr NearestCenterKernel<T> fn = nearestCenterSSE<D>; };
+template<int D, typename T> struct AVX2Kernel { static constexpr NearestCenterKernel<T> fn = nearestCenterAVX2<D>; };
+template<int D, typename T> struct AVX512Kernel { static constexpr NearestCenterKernel<T> fn = nearestCenterAVX512<D>; };
+
+// name of the widest instruction set the CPU supports
+inline std::string detectInstructionSet()
+{
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx512f"))
+		return "avx512";
+	if(__builtin_cpu_supports("avx2"))
+		return "avx2";
+	if(__builtin_cpu_supports("sse4.2"))
+		return "sse4.2";
+	return "scalar";
+}
+
+// isa is one of "auto", "scalar", "sse4.2", "avx2" or "avx512"
+template<typename T = double>
+NearestCenterKernel<T> selectNearestCenter(int total_values, std::string& isa)
+{
+	if(isa == "auto")
+		isa = detectInstructionSet();
+
+	if(isa == "avx512")
+		return selectDimension<AVX512Kernel, T>(total_values);
+	if(isa == "avx2")
+		return selectDimension<AVX2Kernel, T>(total_values);
+	if(isa == "sse4.2")
+		return selectDimension<SSEKernel, T>(total_values);
+	isa = "scalar";
+	return selectDimension<ScalarKernel, T>(total_values);
+}
+
+// Nearest center of a sparse point, given as the count values of entries in their
+// columns, through ||x - c||^2 = ||x||^2 - 2 x.c + ||c||^2: only the rows of the
+// centroid block of the nonzero columns are read, each one a contiguous run of the K
+// centers, so the work is the nonzeros of the point times K. norm is ||x||^2,
+// center_norms the ||c||^2 of every center and dots K values of scratch. The expansion
+// rounds differently from the kernels above, so a near tie may go the other way.
+// The squared distance to the nearest center goes to distance
+template<typename T>
+int nearestCenterSparse(const int32_t* columns, const double* entries, int count, double norm,
+	const T* centroids, const double* center_norms, int K, int stride, double* dots, double& distance)
+{
+	for(int k = 0; k < K; k++)
+		dots[k] = 0.0;
+	for(int e = 0; e < count; e++) {
+		const T* row = centroids + (size_t)columns[e] * stride;
+		double value = entries[e];
+		for(int k = 0; k < K; k++)
+			dots[k] += value * row[k];
+	}
+
+	int id_cluster_center = 0;
+	double min_dist = center_norms[0] - 2 * dots[0];
+	for(int k = 1; k < K; k++) {
+		double dist = center_norms[k] - 2 * dots[k];
+		if(dist < min_dist) {
+			min_dist = dist;
+			id_cluster_center = k;
+		}
+	}
+	distance = std::max(0.0, norm + min_dist);
+	return id_cluster_center;
+}
+
+#endif
@@ -0,0 +1,126 @@
+// Elkan's triangle inequality accelerated assignment
+// Every point keeps an upper bound on the distance to its own center and a
+// lower bound on the distance to every other center. Together with the
+// center to center distances they let most point to center distances be
+// skipped once the centers stop moving much.
+// Memory: total_points x K lower bounds.
+
+#ifndef KMEANS_ELKAN_H
+#define KMEANS_ELKAN_H
+
+#include <algorithm>
+#include <vector>
+#include <tbb/tbb.h>
+
+#include "assignment.h"
+
+class Elkan : public Assignment
+{
+private:
+	// written for every point by the first nearest(), see UntouchedAllocator
+	UntouchedVector<double> upper; // per point
+	UntouchedVector<double> lower; // per point and center, row-major
+	std::vector<double> half_center_dist; // K x K, half the distance between two centers
+	std::vector<double> nearest_half; // per center, half the distance to its nearest other center
+
+public:
+	Elkan(int total_points, int K, int total_values) : Assignment(K, total_values)
+	{
+		this->upper.resize(total_points);
+		this->lower.resize((size_t)total_points * K);
+		this->half_center_dist.resize((size_t)K * K);
+		this->nearest_half.resize(K);
+	}
+
+	size_t getCenterBytes() override
+	{
+		return Assignment::getCenterBytes() + ((size_t)K * K + K) * sizeof(double);
+	}
+
+	void update(const double* centroids, int stride) override
+	{
+		copyCenters(centroids, stride);
+
+		tbb::parallel_for(tbb::blocked_range<int>(0, K),
+			[&](tbb::blocked_range<int>& r) {
+				for(int i = r.begin(); i < r.end(); i++) {
+					double nearest = INFINITY;
+					for(int k = 0; k < K; k++) {
+						double half = lowerBound(0.5 * sqrt(squaredDistance(getCenter(i), getCenter(k), total_values)));
+						this->half_center_dist[(size_t)i * K + k] = half;
+						if(k != i)
+							nearest = std::min(nearest, half);
+					}
+					this->nearest_half[i] = nearest;
+				}
+			}
+		);
+	}
+
+	int nearest(int index, const double* point, int id_cluster, int slot, long& distances) override
+	{
+		double* l = this->lower.data() + (size_t)index * K;
+
+		// no bounds yet, compute every distance
+		if(first_iteration) {
+			int best = 0;
+			double best_dist = INFINITY;
+			for(int j = 0; j < K; j++) {
+				double dist = squaredDistance(point, getCenter(j), total_values);
+				l[j] = lowerBound(sqrt(dist));
+				if(j == 0 || closer(dist, j, best_dist, best)) {
+					best = j;
+					best_dist = dist;
+				}
+			}
+			distances += K;
+			this->upper[index] = upperBound(sqrt(best_dist));
+			return best;
+		}
+
+		// move the bounds along with the centers
+		int best = id_cluster;
+		double u = this->upper[index] + shift[best];
+		for(int j = 0; j < K; j++) {
+			l[j] = std::max(0.0, l[j] - shift[j]);
+		}
+
+		// every other center is more than twice as far from ours as the point is
+		if(u < this->nearest_half[best]) {
+			this->upper[index] = u;
+			return best;
+		}
+
+		bool tight = false;
+		double best_dist = 0.0;
+		for(int j = 0; j < K; j++) {
+			if(j == best || u < l[j] || u < this->half_center_dist[(size_t)best * K + j])
+				continue;
+
+			// tighten the upper bound once before paying for other centers
+			if(!tight) {
+				best_dist = squaredDistance(point, getCenter(best), total_values);
+				distances++;
+				u = upperBound(sqrt(best_dist));
+				l[best] = lowerBound(sqrt(best_dist));
+				tight = true;
+				if(u < l[j] || u < this->half_center_dist[(size_t)best * K + j])
+					continue;
+			}
+
+			double dist = squaredDistance(point, getCenter(j), total_values);
+			distances++;
+			l[j] = lowerBound(sqrt(dist));
+			if(closer(dist, j, best_dist, best)) {
+				best = j;
+				best_dist = dist;
+				u = upperBound(sqrt(dist));
+			}
+		}
+
+		this->upper[index] = u;
+		return best;
+	}
+};
+
+#endif
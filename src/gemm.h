@@ -0,0 +1,305 @@
+// GEMM based nearest center search for high dimensional data
+// ||x - c||^2 = ||x||^2 - 2 x.c + ||c||^2, so the nearest center of a point is the
+// one with the smallest ||c||^2 - 2 x.c, and the cross terms of a tile of points
+// against a chunk of centers are a small matrix product. A register blocked
+// micro-kernel computes GEMM_ROWS points against two vectors of centers at a time
+// and keeps, in every lane, the smallest and second smallest value seen so far;
+// the lanes are then folded into the best center of every point, chunk by chunk.
+// The chunks of centers are sized to stay in the L1 cache while a tile of points
+// streams past them.
+//
+// The expansion rounds differently from the direct sum of the kernels in
+// distance.h. A point whose two best values are closer than the rounding error
+// of the expansion is handed to the brute force kernel, so every point gets the
+// center brute force would pick. That error grows with ||x||^2 + ||c||^2, so the
+// points and the centers are first moved by the mean of the dataset, which leaves
+// the distances alone but keeps the norms, and the fallbacks, small.
+
+#ifndef KMEANS_GEMM_H
+#define KMEANS_GEMM_H
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+#include <tbb/tbb.h>
+
+#include "dataset.h"
+#include "distance.h"
+
+// points per micro-kernel call and per tile handed to Gemm::nearest
+const int GEMM_ROWS = 4;
+const int GEMM_TILE = 64;
+// bytes of centers per chunk, about the L1 data cache
+const int GEMM_CHUNK_BYTES = 32 << 10;
+// the packed centers are padded to a multiple of two of the widest vectors
+const int GEMM_PAD_BYTES = 128;
+
+template<typename T>
+using GemmTileFn = void (*)(const T* points, int rows, int total_values, const T* packed, int padded,
+	const T* norms, int from, int to, T* best, int* best_id, T* second);
+
+// W is the vector width in bytes. Always inlined into the per instruction set
+// wrappers below, so the vector operations are compiled for their target.
+template<typename T, int W>
+__attribute__((always_inline, optimize("fp-contract=fast")))
+inline void gemmTile(const T* points, int rows, int total_values, const T* packed, int padded,
+	const T* norms, int from, int to, T* best, int* best_id, T* second)
+{
+	typedef T V __attribute__((vector_size(W)));
+	const int L = W / sizeof(T);
+	const T inf = std::numeric_limits<T>::infinity();
+
+	const T* x[GEMM_ROWS];
+	for(int r = 0; r < GEMM_ROWS; r++)
+		x[r] = points + (size_t)std::min(r, rows - 1) * total_values;
+
+	V m1[GEMM_ROWS], m2[GEMM_ROWS], id[GEMM_ROWS];
+	V lane_id;
+	for(int l = 0; l < L; l++)
+		lane_id[l] = l;
+	for(int r = 0; r < GEMM_ROWS; r++) {
+		m1[r] = m2[r] = (V){} + inf;
+		id[r] = (V){};
+	}
+
+	for(int k = from; k < to; k += 2 * L) {
+		V acc[GEMM_ROWS][2];
+		for(int r = 0; r < GEMM_ROWS; r++)
+			acc[r][0] = acc[r][1] = (V){};
+
+		const T* column = packed + k;
+		for(int j = 0; j < total_values; j++, column += padded) {
+			V c0 = *(const V*)column;
+			V c1 = *(const V*)(column + L);
+			for(int r = 0; r < GEMM_ROWS; r++) {
+				V xr = (V){} + x[r][j];
+				acc[r][0] += xr * c0;
+				acc[r][1] += xr * c1;
+			}
+		}
+
+		V n0 = *(const V*)(norms + k);
+		V n1 = *(const V*)(norms + k + L);
+		V id0 = lane_id + (T)k;
+		V id1 = id0 + (T)L;
+		for(int r = 0; r < GEMM_ROWS; r++) {
+			V g = n0 - (T)2 * acc[r][0];
+			auto lt = g < m1[r];
+			m2[r] = lt ? m1[r] : (g < m2[r] ? g : m2[r]);
+			m1[r] = lt ? g : m1[r];
+			id[r] = lt ? id0 : id[r];
+
+			g = n1 - (T)2 * acc[r][1];
+			lt = g < m1[r];
+			m2[r] = lt ? m1[r] : (g < m2[r] ? g : m2[r]);
+			m1[r] = lt ? g : m1[r];
+			id[r] = lt ? id1 : id[r];
+		}
+	}
+
+	// fold the lanes into the running best and second best of every point; equal
+	// values end up as best == second and go to brute force, so lane order is irrelevant
+	for(int r = 0; r < rows; r++) {
+		int lane = 0;
+		for(int l = 1; l < L; l++)
+			lane = m1[r][l] < m1[r][lane] ? l : lane;
+		T h1 = m1[r][lane], h2 = inf;
+		for(int l = 0; l < L; l++) {
+			h2 = std::min(h2, m2[r][l]);
+			h2 = l != lane ? std::min(h2, m1[r][l]) : h2;
+		}
+
+		if(h1 < best[r]) {
+			second[r] = std::min(best[r], h2);
+			best[r] = h1;
+			best_id[r] = (int)id[r][lane];
+		} else {
+			second[r] = std::min(second[r], h1);
+		}
+	}
+}
+
+template<typename T>
+__attribute__((optimize("fp-contract=fast")))
+void gemmTileScalar(const T* points, int rows, int total_values, const T* packed, int padded,
+	const T* norms, int from, int to, T* best, int* best_id, T* second)
+{
+	gemmTile<T, 16>(points, rows, total_values, packed, padded, norms, from, to, best, best_id, second);
+}
+
+template<typename T>
+__attribute__((target("avx2,fma"), optimize("fp-contract=fast")))
+void gemmTileAVX2(const T* points, int rows, int total_values, const T* packed, int padded,
+	const T* norms, int from, int to, T* best, int* best_id, T* second)
+{
+	gemmTile<T, 32>(points, rows, total_values, packed, padded, norms, from, to, best, best_id, second);
+}
+
+template<typename T>
+__attribute__((target("avx512f"), optimize("fp-contract=fast")))
+void gemmTileAVX512(const T* points, int rows, int total_values, const T* packed, int padded,
+	const T* norms, int from, int to, T* best, int* best_id, T* second)
+{
+	gemmTile<T, 64>(points, rows, total_values, packed, padded, norms, from, to, best, best_id, second);
+}
+
+// The points minus the mean of the dataset, row-major like the dataset, and their squared
+// norms. They do not depend on the centers, so one copy serves every Gemm over the dataset.
+template<typename T>
+class GemmPoints
+{
+private:
+	int total_values;
+	std::vector<double> mean;
+	std::vector<T, tbb::cache_aligned_allocator<T>> shifted;
+	std::vector<T> norms;
+
+public:
+	// the points are read with dataset.getPointAs<T>
+	GemmPoints(Dataset& dataset)
+	{
+		this->total_values = dataset.getTotalValues();
+		int total_points = dataset.getTotalPoints();
+		this->mean.assign(total_values, 0.0);
+		for(int i = 0; i < total_points; i++) {
+			const T* x = dataset.getPointAs<T>(i);
+			for(int j = 0; j < total_values; j++)
+				this->mean[j] += x[j];
+		}
+		for(int j = 0; j < total_values; j++)
+			this->mean[j] /= total_points;
+
+		this->shifted.resize((size_t)total_points * total_values);
+		this->norms.resize(total_points);
+		tbb::parallel_for(tbb::blocked_range<int>(0, total_points), [&](const tbb::blocked_range<int>& r) {
+			for(int i = r.begin(); i < r.end(); i++) {
+				const T* x = dataset.getPointAs<T>(i);
+				T* moved = this->shifted.data() + (size_t)i * total_values;
+				T norm = 0;
+				for(int j = 0; j < total_values; j++) {
+					moved[j] = shift(x[j], j);
+					norm += moved[j] * moved[j];
+				}
+				this->norms[i] = norm;
+			}
+		});
+	}
+
+	// moved by the mean in double, so the rounding is relative to the moved value
+	T shift(T value, int j) const
+	{
+		return (T)((double)value - this->mean[j]);
+	}
+
+	const T* getPoint(int index) const
+	{
+		return this->shifted.data() + (size_t)index * total_values;
+	}
+
+	T getNorm(int index) const
+	{
+		return this->norms[index];
+	}
+};
+
+template<typename T>
+class Gemm
+{
+private:
+	int K, total_values;
+	int padded; // K rounded up to GEMM_PAD_BYTES worth of values
+	int chunk; // centers per chunk, a multiple of the padding
+	T slack; // relative rounding error allowed between the expansion and the direct sum
+	std::shared_ptr<const GemmPoints<T>> points;
+
+	// transposed centers minus the mean, value j of center k at packed[j * padded + k],
+	// padding columns are 0
+	std::vector<T, tbb::cache_aligned_allocator<T>> packed;
+	// ||c||^2, +infinity for the padding so it is never picked
+	std::vector<T, tbb::cache_aligned_allocator<T>> norms;
+	T max_norm;
+
+	GemmTileFn<T> tile;
+	NearestCenterKernel<T> brute; // the kernel of KMeans, for the points too close to call
+
+public:
+	// isa is the instruction set already resolved by selectNearestCenter
+	Gemm(std::shared_ptr<const GemmPoints<T>> points, int K, int total_values, const std::string& isa,
+		NearestCenterKernel<T> brute)
+	{
+		this->points = points;
+		this->K = K;
+		this->total_values = total_values;
+		const int pad = GEMM_PAD_BYTES / sizeof(T);
+		this->padded = (K + pad - 1) / pad * pad;
+		this->chunk = std::max(pad, GEMM_CHUNK_BYTES / (int)sizeof(T) / total_values / pad * pad);
+		// the expansion, the direct sum and the move by the mean are each off by about D + 2
+		// roundings of the magnitudes involved, bounded by ||x||^2 + max ||c||^2
+		this->slack = 16 * (total_values + 4) * std::numeric_limits<T>::epsilon();
+
+		this->packed.assign((size_t)padded * total_values, 0);
+		this->norms.assign(padded, std::numeric_limits<T>::infinity());
+		this->max_norm = 0;
+		this->brute = brute;
+
+		if(isa == "avx512")
+			this->tile = gemmTileAVX512<T>;
+		else if(isa == "avx2")
+			this->tile = gemmTileAVX2<T>;
+		else
+			this->tile = gemmTileScalar<T>;
+	}
+
+	// called once per iteration with the block read by the kernels (see distance.h)
+	void update(const T* centroids, int stride)
+	{
+		this->max_norm = 0;
+		for(int k = 0; k < K; k++) {
+			T norm = 0;
+			for(int j = 0; j < total_values; j++) {
+				T value = this->points->shift(centroids[j * stride + k], j);
+				this->packed[(size_t)j * padded + k] = value;
+				norm += value * value;
+			}
+			this->norms[k] = norm;
+			this->max_norm = std::max(this->max_norm, norm);
+		}
+	}
+
+	// nearest center of the points [first, first + count) into ids; centroids and stride
+	// are the block handed to update(), for the brute force fallback
+	void nearest(Dataset& dataset, int first, int count, int* ids, const T* centroids, int stride)
+	{
+		T best[GEMM_TILE], second[GEMM_TILE];
+		int best_id[GEMM_TILE];
+
+		for(int start = 0; start < count; start += GEMM_TILE) {
+			int n = std::min(GEMM_TILE, count - start);
+			const T* tile_points = this->points->getPoint(first + start);
+			std::fill(best, best + n, std::numeric_limits<T>::infinity());
+			std::fill(second, second + n, std::numeric_limits<T>::infinity());
+			std::fill(best_id, best_id + n, 0);
+
+			for(int from = 0; from < padded; from += chunk) {
+				int to = std::min(padded, from + chunk);
+				for(int r = 0; r < n; r += GEMM_ROWS) {
+					this->tile(tile_points + (size_t)r * total_values, std::min(GEMM_ROWS, n - r), total_values,
+						this->packed.data(), padded, this->norms.data(), from, to, best + r, best_id + r, second + r);
+				}
+			}
+
+			for(int r = 0; r < n; r++) {
+				int i = first + start + r;
+				if(second[r] - best[r] <= this->slack * (this->points->getNorm(i) + this->max_norm))
+					ids[start + r] = this->brute(dataset.getPointAs<T>(i), centroids, K, stride, total_values);
+				else
+					ids[start + r] = best_id[r];
+			}
+		}
+	}
+};
+
+#endif
@@ -0,0 +1,118 @@
+// Hamerly's single bound accelerated assignment
+// Like Elkan, but a point only keeps an upper bound on the distance to its own
+// center and one lower bound on the distance to every other center, plus each
+// center's distance to its nearest other center. Memory stays at two doubles
+// per point, which suits large, low dimensional datasets with many clusters.
+
+#ifndef KMEANS_HAMERLY_H
+#define KMEANS_HAMERLY_H
+
+#include <algorithm>
+#include <vector>
+#include <tbb/tbb.h>
+
+#include "assignment.h"
+
+class Hamerly : public Assignment
+{
+private:
+	// written for every point by the first nearest(), see UntouchedAllocator
+	UntouchedVector<double> upper; // per point, distance to its own center
+	UntouchedVector<double> lower; // per point, distance to the second closest center
+	std::vector<double> nearest_half; // per center, half the distance to its nearest other center
+	double max_shift, second_max_shift; // largest moves of this iteration
+	int max_shift_center;
+
+public:
+	Hamerly(int total_points, int K, int total_values) : Assignment(K, total_values)
+	{
+		this->upper.resize(total_points);
+		this->lower.resize(total_points);
+		this->nearest_half.resize(K);
+	}
+
+	void update(const double* centroids, int stride) override
+	{
+		copyCenters(centroids, stride);
+
+		tbb::parallel_for(tbb::blocked_range<int>(0, K),
+			[&](tbb::blocked_range<int>& r) {
+				for(int i = r.begin(); i < r.end(); i++) {
+					double nearest = INFINITY;
+					for(int k = 0; k < K; k++) {
+						if(k != i)
+							nearest = std::min(nearest, squaredDistance(getCenter(i), getCenter(k), total_values));
+					}
+					this->nearest_half[i] = lowerBound(0.5 * sqrt(nearest));
+				}
+			}
+		);
+
+		// the lower bound of a point drops by the largest move among the centers it is not assigned to
+		this->max_shift = 0.0;
+		this->second_max_shift = 0.0;
+		this->max_shift_center = -1;
+		for(int i = 0; i < K; i++) {
+			if(shift[i] > this->max_shift) {
+				this->second_max_shift = this->max_shift;
+				this->max_shift = shift[i];
+				this->max_shift_center = i;
+			} else if(shift[i] > this->second_max_shift) {
+				this->second_max_shift = shift[i];
+			}
+		}
+	}
+
+	size_t getCenterBytes() override
+	{
+		return Assignment::getCenterBytes() + K * sizeof(double);
+	}
+
+	int nearest(int index, const double* point, int id_cluster, int slot, long& distances) override
+	{
+		int best = id_cluster;
+
+		if(!first_iteration) {
+			double u = this->upper[index] + shift[best];
+			double l = std::max(0.0, this->lower[index] - (best == max_shift_center ? second_max_shift : max_shift));
+			double bound = std::max(this->nearest_half[best], l);
+
+			if(u < bound) {
+				this->upper[index] = u;
+				this->lower[index] = l;
+				return best;
+			}
+
+			// tighten the upper bound and try again
+			double dist = sqrt(squaredDistance(point, getCenter(best), total_values));
+			distances++;
+			u = upperBound(dist);
+			if(u < bound) {
+				this->upper[index] = u;
+				this->lower[index] = l;
+				return best;
+			}
+		}
+
+		// bounds failed, compute every distance and keep the two smallest
+		double best_dist = INFINITY, second_dist = INFINITY;
+		best = 0;
+		for(int j = 0; j < K; j++) {
+			double dist = squaredDistance(point, getCenter(j), total_values);
+			if(j == 0 || closer(dist, j, best_dist, best)) {
+				second_dist = best_dist;
+				best = j;
+				best_dist = dist;
+			} else if(dist < second_dist) {
+				second_dist = dist;
+			}
+		}
+		distances += K;
+
+		this->upper[index] = upperBound(sqrt(best_dist));
+		this->lower[index] = lowerBound(sqrt(second_dist));
+		return best;
+	}
+};
+
+#endif
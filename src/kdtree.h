@@ -0,0 +1,347 @@
+// kd-tree filtering assignment (Kanungo et al.)
+// A kd-tree is built once over the points, every node keeping the bounding box,
+// the sum, the sum of squared norms and the number of its points. Each iteration
+// walks the tree from the root with the list of centers that may still own a
+// point of the node: the candidate closest to the middle of the box removes every
+// other candidate that is farther than it from the box corner in their direction,
+// and once a single candidate is left the whole subtree goes to it through the
+// node sums. Only the leaves that are still contested look at their points.
+// The cluster sums come straight out of the walk, so they replace the previous
+// ones instead of being updated point by point.
+
+#ifndef KMEANS_KDTREE_H
+#define KMEANS_KDTREE_H
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <vector>
+#include <tbb/tbb.h>
+
+#include "dataset.h"
+#include "distance.h"
+
+// most points kept in a leaf
+const int KDTREE_LEAF = 16;
+// nodes with more points walk their two children as separate tasks
+const int KDTREE_TASK_POINTS = 8192;
+// relative slack of the pruning test, so the rounding of the distances to a box corner
+// can only keep a candidate the exact search would have dropped, never the reverse
+const double KDTREE_SLACK = 1e-10;
+
+class KdTree
+{
+private:
+	struct Node
+	{
+		int begin, end; // points [begin, end) of the tree order
+		int left, right; // children, -1 for a leaf
+		int depth;
+		int slot; // row of top_candidates for the nodes walked as tasks, -1 otherwise
+	};
+
+	int K, total_values;
+	std::vector<Node> nodes;
+	std::vector<int> index; // dataset index of every point, in tree order
+	std::vector<double> points; // row-major copy of the points, in tree order
+	std::vector<double> lower, upper; // per node, corners of the bounding box
+	std::vector<double> sums; // per node, sum of the points
+	std::vector<double> squares; // per node, sum of the squared norms of the points
+	int max_depth;
+	int tasks; // nodes walked as tasks
+
+	// row-major copy of the centers of this iteration
+	std::vector<double> centers;
+
+	// candidate lists, K per row: one row per task node, and one row per tree level for
+	// every worker slot of the arena. A worker only leaves its rows for another task while
+	// it waits on a task node, whose list lives in top_candidates, so the rows are never shared.
+	std::vector<int> top_candidates;
+	std::vector<int> scratch;
+	std::vector<int> all_centers; // 0, 1, ..., K - 1, the candidates of the root
+
+	const double* getCenter(int id_cluster)
+	{
+		return this->centers.data() + (size_t)id_cluster * total_values;
+	}
+
+	// split the points [begin, end) of index along the widest side of their box
+	int build(Dataset& dataset, int begin, int end, int depth)
+	{
+		int id = this->nodes.size();
+		this->nodes.push_back({begin, end, -1, -1, depth, -1});
+		this->max_depth = std::max(this->max_depth, depth);
+		if(end - begin <= KDTREE_LEAF)
+			return id;
+
+		int widest = 0;
+		double widest_side = -1.0;
+		for(int j = 0; j < total_values; j++) {
+			double low = INFINITY, high = -INFINITY;
+			for(int i = begin; i < end; i++) {
+				low = std::min(low, dataset.getValue(this->index[i], j));
+				high = std::max(high, dataset.getValue(this->index[i], j));
+			}
+			if(high - low > widest_side) {
+				widest_side = high - low;
+				widest = j;
+			}
+		}
+
+		int middle = begin + (end - begin) / 2;
+		std::nth_element(this->index.begin() + begin, this->index.begin() + middle, this->index.begin() + end,
+			[&](int a, int b) { return dataset.getValue(a, widest) < dataset.getValue(b, widest); });
+
+		int left = build(dataset, begin, middle, depth + 1);
+		int right = build(dataset, middle, end, depth + 1);
+		this->nodes[id].left = left;
+		this->nodes[id].right = right;
+		return id;
+	}
+
+	// box, sum and squared norms of a node, from its points for a leaf and from its children otherwise
+	void summarize(int id)
+	{
+		const Node& node = this->nodes[id];
+		double* low = this->lower.data() + (size_t)id * total_values;
+		double* high = this->upper.data() + (size_t)id * total_values;
+		double* sum = this->sums.data() + (size_t)id * total_values;
+
+		if(node.left == -1) {
+			std::fill(low, low + total_values, INFINITY);
+			std::fill(high, high + total_values, -INFINITY);
+			std::fill(sum, sum + total_values, 0.0);
+			double square = 0.0;
+			for(int i = node.begin; i < node.end; i++) {
+				const double* point = this->points.data() + (size_t)i * total_values;
+				for(int j = 0; j < total_values; j++) {
+					low[j] = std::min(low[j], point[j]);
+					high[j] = std::max(high[j], point[j]);
+					sum[j] += point[j];
+					square += point[j] * point[j];
+				}
+			}
+			this->squares[id] = square;
+			return;
+		}
+
+		summarize(node.left);
+		summarize(node.right);
+		for(int j = 0; j < total_values; j++) {
+			low[j] = std::min(this->lower[(size_t)node.left * total_values + j], this->lower[(size_t)node.right * total_values + j]);
+			high[j] = std::max(this->upper[(size_t)node.left * total_values + j], this->upper[(size_t)node.right * total_values + j]);
+			sum[j] = this->sums[(size_t)node.left * total_values + j] + this->sums[(size_t)node.right * total_values + j];
+		}
+		this->squares[id] = this->squares[node.left] + this->squares[node.right];
+	}
+
+	// keep the candidates of from[0, count) that may own a point of the box of node id,
+	// in the same order, and return how many there are
+	int filter(int id, const int* from, int count, int* to, long& distances)
+	{
+		const double* low = this->lower.data() + (size_t)id * total_values;
+		const double* high = this->upper.data() + (size_t)id * total_values;
+
+		// the candidate closest to the middle of the box, ties to the lower id
+		int best = from[0];
+		double best_dist = INFINITY;
+		double diagonal = 0.0;
+		for(int c = 0; c < count; c++) {
+			const double* center = getCenter(from[c]);
+			double dist = 0.0;
+			for(int j = 0; j < total_values; j++) {
+				double diff = center[j] - (low[j] + high[j]) / 2;
+				dist += diff * diff;
+			}
+			if(dist < best_dist) {
+				best_dist = dist;
+				best = from[c];
+			}
+		}
+		for(int j = 0; j < total_values; j++)
+			diagonal += (high[j] - low[j]) * (high[j] - low[j]);
+		distances += count;
+
+		// z can be dropped when it is farther than the best candidate from the corner of the
+		// box that lies furthest in the direction of z
+		const double* z_best = getCenter(best);
+		int kept = 0;
+		for(int c = 0; c < count; c++) {
+			int z = from[c];
+			if(z == best) {
+				to[kept++] = z;
+				continue;
+			}
+
+			const double* center = getCenter(z);
+			double z_dist = 0.0, best_corner_dist = 0.0;
+			for(int j = 0; j < total_values; j++) {
+				double corner = center[j] > z_best[j] ? high[j] : low[j];
+				z_dist += (center[j] - corner) * (center[j] - corner);
+				best_corner_dist += (z_best[j] - corner) * (z_best[j] - corner);
+			}
+			distances += 2;
+			if(z_dist - best_corner_dist <= KDTREE_SLACK * (z_dist + best_corner_dist + diagonal))
+				to[kept++] = z;
+		}
+		return kept;
+	}
+
+	// the whole subtree of node id goes to center z
+	template<typename V>
+	void assignNode(int* labels, int id, int z, V& view, bool record)
+	{
+		const Node& node = this->nodes[id];
+		const double* sum = this->sums.data() + (size_t)id * total_values;
+		view.addSum(sum, node.end - node.begin, z);
+
+		int change = 0;
+		for(int i = node.begin; i < node.end; i++) {
+			if(labels[this->index[i]] != z) {
+				labels[this->index[i]] = z;
+				change++;
+			}
+		}
+		view.addChange(change);
+
+		// sum of ||x - z||^2 = sum of ||x||^2 - 2 z.sum + count ||z||^2
+		if(record) {
+			const double* center = getCenter(z);
+			double dot = 0.0, norm = 0.0;
+			for(int j = 0; j < total_values; j++) {
+				dot += center[j] * sum[j];
+				norm += center[j] * center[j];
+			}
+			view.addInertia(this->squares[id] - 2 * dot + (node.end - node.begin) * norm);
+		}
+	}
+
+	// compare every point of a contested leaf with the candidates, in id order like the brute force search
+	template<typename V>
+	void assignLeaf(int* labels, int id, const int* candidates, int count, V& view, bool record)
+	{
+		const Node& node = this->nodes[id];
+		int change = 0;
+		double inertia = 0.0;
+		for(int i = node.begin; i < node.end; i++) {
+			const double* point = this->points.data() + (size_t)i * total_values;
+			int best = candidates[0];
+			double best_dist = squaredDistance(point, getCenter(best), total_values);
+			for(int c = 1; c < count; c++) {
+				double dist = squaredDistance(point, getCenter(candidates[c]), total_values);
+				if(dist < best_dist) {
+					best_dist = dist;
+					best = candidates[c];
+				}
+			}
+
+			view.addSum(point, 1, best);
+			if(labels[this->index[i]] != best) {
+				labels[this->index[i]] = best;
+				change++;
+			}
+			inertia += best_dist;
+		}
+		view.addChange(change);
+		view.addDistances((long)(node.end - node.begin) * count);
+		if(record)
+			view.addInertia(inertia);
+	}
+
+	template<typename V>
+	void walk(int* labels, int id, const int* candidates, int count, std::vector<V>& views, bool record)
+	{
+		const Node& node = this->nodes[id];
+		int slot = tbb::this_task_arena::current_thread_index();
+		V& view = views[slot];
+
+		int* kept = node.slot != -1
+			? this->top_candidates.data() + (size_t)node.slot * K
+			: this->scratch.data() + ((size_t)slot * (this->max_depth + 1) + node.depth) * K;
+		long distances = 0;
+		if(count > 1)
+			count = filter(id, candidates, count, kept, distances);
+		else
+			kept[0] = candidates[0];
+		view.addDistances(distances);
+
+		if(count == 1) {
+			assignNode(labels, id, kept[0], view, record);
+		} else if(node.left == -1) {
+			assignLeaf(labels, id, kept, count, view, record);
+		} else if(node.slot != -1) {
+			tbb::parallel_invoke(
+				[&]() { walk(labels, node.left, kept, count, views, record); },
+				[&]() { walk(labels, node.right, kept, count, views, record); }
+			);
+		} else {
+			walk(labels, node.left, kept, count, views, record);
+			walk(labels, node.right, kept, count, views, record);
+		}
+	}
+
+public:
+	// the tree only depends on the points, setK() sizes it for a number of centers
+	KdTree(Dataset& dataset, int K)
+	{
+		this->total_values = dataset.getTotalValues();
+		int total_points = dataset.getTotalPoints();
+
+		this->index.resize(total_points);
+		for(int i = 0; i < total_points; i++)
+			this->index[i] = i;
+		this->max_depth = 0;
+		build(dataset, 0, total_points, 0);
+
+		this->points.resize((size_t)total_points * total_values);
+		for(int i = 0; i < total_points; i++) {
+			const double* point = dataset.getPoint(this->index[i]);
+			std::copy(point, point + total_values, this->points.begin() + (size_t)i * total_values);
+		}
+
+		size_t total_nodes = this->nodes.size();
+		this->lower.resize(total_nodes * total_values);
+		this->upper.resize(total_nodes * total_values);
+		this->sums.resize(total_nodes * total_values);
+		this->squares.resize(total_nodes);
+		summarize(0);
+
+		this->tasks = 0;
+		for(Node& node : this->nodes) {
+			if(node.left != -1 && node.end - node.begin > KDTREE_TASK_POINTS)
+				node.slot = this->tasks++;
+		}
+		setK(K);
+	}
+
+	// size the candidate lists and the centers for K centers, so a tree can be handed on
+	// to a run with another K
+	void setK(int K)
+	{
+		this->K = K;
+		this->top_candidates.resize((size_t)std::max(this->tasks, 1) * K);
+		this->scratch.resize((size_t)tbb::this_task_arena::max_concurrency() * (this->max_depth + 1) * K);
+		this->centers.resize((size_t)K * total_values);
+		this->all_centers.resize(K);
+		std::iota(this->all_centers.begin(), this->all_centers.end(), 0);
+	}
+
+	// called once per iteration with the block read by the kernels (see distance.h)
+	void update(const double* centroids, int stride)
+	{
+		for(int i = 0; i < K; i++) {
+			for(int j = 0; j < total_values; j++)
+				this->centers[(size_t)i * total_values + j] = centroids[j * stride + i];
+		}
+	}
+
+	// assign every point, updating labels, and add the full cluster sums into the views, one
+	// per worker slot; V needs addSum, addChange, addDistances and addInertia
+	template<typename V>
+	void assign(int* labels, std::vector<V>& views, bool record)
+	{
+		walk(labels, 0, this->all_centers.data(), K, views, record);
+	}
+};
+
+#endif
@@ -0,0 +1,54 @@
+// Converter from the text dataset format to the binary one mapped by Dataset::open
+// (a binary input is rewritten, e.g. to a float32 matrix, or to the sparse format
+// with --sparse, which keeps the nonzero values only; a sparse input stays sparse)
+// usage: kmeans-convert input.txt output.bin [--float32 | --sparse]
+
+#include <iostream>
+#include <fstream>
+#include <string>
+
+#include "dataset.h"
+
+
+using namespace std;
+
+int main(int argc, char *argv[])
+{
+	if (argc < 3) {
+		std::cerr << "Usage: kmeans-convert input.txt output.bin [--float32 | --sparse]";
+		exit(1);
+	}
+
+	bool single = false, sparse = false;
+	for(int i = 3; i < argc; i++) {
+		string arg = argv[i];
+		if(arg == "--float32") {
+			single = true;
+		} else if(arg == "--sparse") {
+			sparse = true;
+		} else {
+			std::cerr << "Unknown option " << arg;
+			exit(1);
+		}
+	}
+
+	Dataset dataset;
+	if (!dataset.open(argv[1])) {
+		std::cerr << "Unable to open " << argv[1] << ": " << dataset.getError();
+		exit(1);
+	}
+	if(single && (sparse || dataset.isSparse())) {
+		std::cerr << "--float32 does not apply to a sparse dataset";
+		exit(1);
+	}
+	if(sparse)
+		dataset.sparsify();
+
+	ofstream outputFile(argv[2], ios::binary);
+	if (!outputFile || !dataset.save(outputFile, single)) {
+		std::cerr << "Unable to write " << argv[2];
+		exit(1);
+	}
+
+	return 0;
+}
@@ -14,139 +14,275 @@
 #include <tbb/tbb_allocator.h>
 #include <tbb/enumerable_thread_specific.h>
 #include <atomic>
+#include <memory>
+#include <sys/wait.h>
+
+#include "allocations.h"
+#include "allreduce.h"
+#include "dataset.h"
+#include "distance.h"
+#include "elkan.h"
+#include "gemm.h"
+#include "hamerly.h"
+#include "kdtree.h"
+#include "numa.h"
+#include "predict.h"
+#include "seeding.h"
+#include "yinyang.h"
 
 
 using namespace std;
 
-const int constK = 32;
-const int const_total_values = 3;
+// random stream of the mini-batch sampling, apart from the ones used by seeding.h
+const uint64_t MINIBATCH_STREAM = 1 << 20;
 
-class Point
-{
-private:
-	int id_point, id_cluster;
-	vector<double> values;
-	int total_values;
-	string name;
-
-public:
-	Point(int id_point, vector<double>& values, string name = "")
-	{
-		this->id_point = id_point;
-		total_values = values.size();
-
-		for(int i = 0; i < total_values; i++)
-			this->values.push_back(values[i]);
-
-		this->name = name;
-		this->id_cluster = -1;
-	}
-
-	int getID()
-	{
-		return this->id_point;
-	}
-
-	void setCluster(int id_cluster)
-	{
-		this->id_cluster = id_cluster;
-	}
-
-	int getCluster()
-	{
-		return this->id_cluster;
-	}
-
-	double getValue(int index)
-	{
-		return this->values[index];
-	}
-
-	int getTotalValues()
-	{
-		return total_values;
-	}
-
-	void addValue(double value)
-	{
-		this->values.push_back(value);
-	}
+// points per block of the deterministic reduction
+const int DETERMINISTIC_BLOCK = 4096;
 
-	string getName()
-	{
-		return this->name;
-	}
+// run time settings of kmeans-parallel, filled from the flags after the dataset file
+struct Options
+{
+	string isa = "auto"; // instruction set of the brute force kernel (see distance.h)
+	string assignment = "brute"; // brute, gemm, elkan, hamerly, yinyang or kdtree
+	int groups = 0; // center groups of yinyang, 0 for K / 10
+	int K = 0; // number of clusters, 0 to use the dataset header
+	string init = "legacy"; // seeding: legacy (srand/rand), kmeans++ or kmeans||
+	uint64_t seed = 1; // seed of kmeans++ and kmeans||
+	double oversampling = 0; // points picked per kmeans|| round, 0 for 2K
+	int rounds = 5; // oversampling rounds of kmeans||
+	int batch_size = 0; // points per mini-batch, 0 for full Lloyd iterations
+	double tol_shift = -1; // stop once no center moves more than this times the mean feature variance, -1 for the mode default (off for Lloyd)
+	double tol_inertia = -1; // stop once the inertia improves by no more than this fraction, -1 for off
+	double tol_changed = -1; // stop once no more than this fraction of the points changes cluster, -1 for off
+	string telemetry; // file that gets one JSON record per Lloyd iteration, empty for none
+	string precision = "float64"; // coordinates compared by the kernels: float64 or float32
+	string labels; // file that gets the final cluster of every point, one per line, empty for none
+	string centroids; // file that gets the final centers for kmeans-parallel predict, empty for none
+	bool deterministic = false; // sum the clusters in fixed blocks so the result does not depend on the threads
+	int threads = 0; // worker threads, 0 for one per core
+	int n_init = 1; // restarts run side by side, the one with the lowest inertia is kept
+	int k_from = 0, k_to = 0; // K values swept, each warm started from the previous one, 0 for no sweep
+	int processes = 1; // processes that each own a shard of the points, see allreduce.h
+	string transport = "shm"; // allreduce between the processes: shm or tcp
+	int rank = 0; // shard of this process, set by rank 0 on the processes it starts
+	string endpoint; // allreduce endpoint created by rank 0, empty on rank 0
+	bool numa = false; // place the points and pin the threads per NUMA node, see numa.h
 };
 
+// points [first, second) of shard rank out of size equal runs of points
+pair<int, int> shardRange(int total_points, int rank, int size)
+{
+	return {(long)total_points * rank / size, (long)total_points * (rank + 1) / size};
+}
+
 class View {
   private:
 	struct view {
 		vector<int> total_points; // keep track of total points;
-		int change; // keep track of the number of changes
+		int change; // keep track of the number of points that joined a cluster
+		long distances; // point to center distances computed by the assignment engine
+		double inertia; // squared distance of the points to their centers, only summed for the telemetry
 
 		// keep track of intermediate_central_values
 			// 1 vector level for every cluster a thread 
 			// may encounter and another vector level for multiple values of a point 
 		vector<vector<double>> intermediate_central_values; 
+
+		// clusters whose sums were written since they were last reset, so that merging and
+		// resetting skip the others: with sparse points and a large dimension most clusters
+		// of a thread's view stay untouched in an iteration
+		vector<char> touched;
 	};
 	view view;
+	int K; // number of clusters, taken from the dataset header
+	int total_values; // dimension of a point, taken from the dataset header
   public:
-	View() {
-		this->view.total_points = vector<int>(constK);
-		for (int i = 0; i < constK; i++) {
+	View(int K, int total_values) {
+		this->K = K;
+		this->total_values = total_values;
+		this->view.total_points = vector<int>(K);
+		for (int i = 0; i < K; i++) {
 			this->view.total_points[i] = 0;
 		}
 		this->view.change = 0;
-		this->view.intermediate_central_values = vector<vector<double>>(constK);
-		for (int i = 0; i < constK; i++) {
-			this->view.intermediate_central_values[i] = vector<double>(const_total_values, 0);
+		this->view.distances = 0;
+		this->view.inertia = 0.0;
+		this->view.intermediate_central_values = vector<vector<double>>(K);
+		for (int i = 0; i < K; i++) {
+			this->view.intermediate_central_values[i] = vector<double>(total_values, 0);
 		}
+		this->view.touched = vector<char>(K, 0);
 	}
 
 	void getAllIntermediateValues() {
-		for(int i = 0; i < constK; i++) {
-			for(int j = 0; j < const_total_values; j++) {
+		for(int i = 0; i < K; i++) {
+			for(int j = 0; j < total_values; j++) {
 				cout << this->view.intermediate_central_values[i][j] << " ";
 			}
 		}
 	}
 
-	vector<double> getIntermediateCentralValues(int index) {
+	const vector<double>& getIntermediateCentralValues(int index) const {
 		return this->view.intermediate_central_values[index];
 	}
 
-	int getTotalPoints(int index) {
+	int getTotalPoints(int index) const {
 		return this->view.total_points[index];
 	}
 
-	void addPoint(Point point, int clusterId) {
+	bool isTouched(int index) const {
+		return this->view.touched[index];
+	}
+
+	void addPoint(const double* point, int clusterId) {
+		this->view.touched[clusterId] = 1;
 		this->view.total_points[clusterId]++;
-		for (int i = 0; i < const_total_values; i++) {
-			this->view.intermediate_central_values[clusterId][i] += point.getValue(i);
+		for (int i = 0; i < total_values; i++) {
+			this->view.intermediate_central_values[clusterId][i] += point[i];
 		}
 		this->view.change++;
 	}
 
-	void removePoint(Point point, int clusterId) {
+	void removePoint(const double* point, int clusterId) {
+		this->view.touched[clusterId] = 1;
 		this->view.total_points[clusterId]--;
-		for (int i = 0; i < const_total_values; i++) {
-			this->view.intermediate_central_values[clusterId][i] -= point.getValue(i);
+		for (int i = 0; i < total_values; i++) {
+			this->view.intermediate_central_values[clusterId][i] -= point[i];
+		}
+	}
+
+	// scatter-add a sparse point, its count values go to their columns
+	void addSparse(const int32_t* columns, const double* entries, int count, int clusterId) {
+		this->view.touched[clusterId] = 1;
+		this->view.total_points[clusterId]++;
+		vector<double>& sums = this->view.intermediate_central_values[clusterId];
+		for (int e = 0; e < count; e++) {
+			sums[columns[e]] += entries[e];
 		}
 		this->view.change++;
 	}
 
-	int getChange() {
+	void removeSparse(const int32_t* columns, const double* entries, int count, int clusterId) {
+		this->view.touched[clusterId] = 1;
+		this->view.total_points[clusterId]--;
+		vector<double>& sums = this->view.intermediate_central_values[clusterId];
+		for (int e = 0; e < count; e++) {
+			sums[columns[e]] -= entries[e];
+		}
+	}
+
+	// add count points whose values sum to sum, used by the kd-tree walk
+	void addSum(const double* sum, int count, int clusterId) {
+		this->view.touched[clusterId] = 1;
+		this->view.total_points[clusterId] += count;
+		for (int i = 0; i < total_values; i++) {
+			this->view.intermediate_central_values[clusterId][i] += sum[i];
+		}
+	}
+
+	void addChange(int change) {
+		this->view.change += change;
+	}
+
+	int getChange() const {
 		return this->view.change;
 	}
 
-	void reset() {
-		for (int i = 0; i < constK; i++) {
-			this->view.total_points[i] = 0;
-			for (int j = 0; j < const_total_values; j++) {
-				this->view.intermediate_central_values[i][j] = 0;
+	void addDistances(long distances) {
+		this->view.distances += distances;
+	}
+
+	long getDistances() const {
+		return this->view.distances;
+	}
+
+	void addInertia(double inertia) {
+		this->view.inertia += inertia;
+	}
+
+	double getInertia() const {
+		return this->view.inertia;
+	}
+
+	// add the sums of another view, used by the deterministic reduction tree
+	void merge(const View& other) {
+		for (int i = 0; i < K; i++) {
+			if (!other.view.touched[i]) {
+				continue;
+			}
+			this->view.touched[i] = 1;
+			this->view.total_points[i] += other.view.total_points[i];
+			for (int j = 0; j < total_values; j++) {
+				this->view.intermediate_central_values[i][j] += other.view.intermediate_central_values[i][j];
 			}
 		}
+		this->view.change += other.view.change;
+		this->view.distances += other.view.distances;
+		this->view.inertia += other.view.inertia;
+	}
+
+	// values written by pack(): the size and sums of every cluster, then the counters
+	size_t packedSize() const {
+		return (size_t)K * (total_values + 1) + 3;
+	}
+
+	// add this view into buffer, laid out for the allreduce between processes
+	void pack(double* buffer) const {
+		for (int i = 0; i < K; i++) {
+			if (!this->view.touched[i]) {
+				continue;
+			}
+			double* cluster = buffer + (size_t)i * (total_values + 1);
+			cluster[0] += this->view.total_points[i];
+			for (int j = 0; j < total_values; j++) {
+				cluster[1 + j] += this->view.intermediate_central_values[i][j];
+			}
+		}
+		double* counters = buffer + (size_t)K * (total_values + 1);
+		counters[0] += this->view.change;
+		counters[1] += this->view.distances;
+		counters[2] += this->view.inertia;
+	}
+
+	// replace this view with a buffer filled by pack()
+	void unpack(const double* buffer) {
+		for (int i = 0; i < K; i++) {
+			const double* cluster = buffer + (size_t)i * (total_values + 1);
+			this->view.touched[i] = 1;
+			this->view.total_points[i] = (int)cluster[0];
+			for (int j = 0; j < total_values; j++) {
+				this->view.intermediate_central_values[i][j] = cluster[1 + j];
+			}
+		}
+		const double* counters = buffer + (size_t)K * (total_values + 1);
+		this->view.change = (int)counters[0];
+		this->view.distances = (long)counters[1];
+		this->view.inertia = counters[2];
+	}
+
+	// clear the sums of one cluster, so the clusters can be reset in parallel
+	void resetCluster(int index) {
+		if (!this->view.touched[index]) {
+			return;
+		}
+		this->view.touched[index] = 0;
+		this->view.total_points[index] = 0;
+		for (int j = 0; j < total_values; j++) {
+			this->view.intermediate_central_values[index][j] = 0;
+		}
+	}
+
+	void resetCounters() {
 		this->view.change = 0;
+		this->view.distances = 0;
+		this->view.inertia = 0.0;
+	}
+
+	void reset() {
+		for (int i = 0; i < K; i++) {
+			resetCluster(i);
+		}
+		resetCounters();
 	}
 
 };
@@ -162,18 +298,28 @@ private:
 	int change;
 
 public:
-	Cluster(int id_cluster, Point point)
+	// empty cluster, filled through operator+=
+	Cluster(int id_cluster, int total_values)
 	{
 		this->id_cluster = id_cluster;
 		this->change = 0;
+		this->total_values = total_values;
+		this->central_values.assign(total_values, 0.0);
+		this->intermediate_central_values.assign(total_values, 0.0);
+	}
 
-		total_values = point.getTotalValues();
+	Cluster(int id_cluster, const double* point, int total_values)
+	{
+		this->id_cluster = id_cluster;
+		this->change = 0;
+
+		this->total_values = total_values;
 		
 		this->total_points++;
 
 		for(int i = 0; i < total_values; i++) {
-			this->intermediate_central_values.push_back(point.getValue(i));
-			this->central_values.push_back(point.getValue(i));
+			this->intermediate_central_values.push_back(point[i]);
+			this->central_values.push_back(point[i]);
 		}
 	}
 
@@ -206,16 +352,25 @@ public:
 		return this->total_points;
 	}
 
+	// drop the sums, for views that hold the whole cluster rather than the changes
+	void clear()
+	{
+		this->total_points = 0;
+		for (int i = 0; i < total_values; i++) {
+			this->intermediate_central_values[i] = 0;
+		}
+	}
+
 	int getID()
 	{
 		return this->id_cluster;
 	}
 
-	Cluster& operator+=(View view) {
+	Cluster& operator+=(const View& view) {
 		int index = this->id_cluster;
 		this->total_points += view.getTotalPoints(index);
 		this->change += view.getChange();
-		vector<double> intermediates = view.getIntermediateCentralValues(index);
+		const vector<double>& intermediates = view.getIntermediateCentralValues(index);
 		for (int j = 0; j < total_values; j++) {
 			this->intermediate_central_values[j] += intermediates[j];
 		}
@@ -223,73 +378,160 @@ public:
 	}
 };
 
+// T is the coordinate type the distances are computed in (double or float). The cluster
+// sums stay double whatever T is, only the centroid block and the points handed to the
+// kernels are T.
+template<typename T>
 class KMeans
 {
 private:
 	int K; // number of clusters
 	int total_values, total_points, max_iterations;
 	vector<Cluster> clusters;
+	vector<char> stale; // clusters whose sums changed since their center was last computed
+
+	// transposed copy of the cluster centers read by the nearest center kernels (see distance.h)
+	vector<T, tbb::cache_aligned_allocator<T>> centroids;
+	int stride;
+	string isa; // instruction set of the nearest center kernel
+	NearestCenterKernel<T> nearest_center;
+	NearestCenterFn seeding_center; // float64 kernel used by kmeans|| on the dataset points
+	unique_ptr<Assignment> engine; // accelerated assignment, null for brute force
+	unique_ptr<Gemm<T>> gemm; // matrix product search over tiles of points, null unless --assign gemm
+	shared_ptr<const GemmPoints<T>> gemm_points; // the points as read by gemm, kept for a warm start
+	shared_ptr<KdTree> kdtree; // filtering over a kd-tree of the points, null unless --assign kdtree
+	Options options;
+	ofstream telemetry; // per iteration records, open when options.telemetry is set
+	UntouchedVector<int> labels; // cluster of every point, -1 until its first assignment, see setNuma
+	bool quiet = false; // no per iteration lines, for restarts that run side by side
+	bool warm = false; // the clusters come from warmStart() rather than chooseCenters()
+
+	// points [first_point, last_point) are the shard of this process, all of them without comm
+	Allreduce* comm = nullptr;
+	int first_point, last_point;
+	vector<double> exchange; // packed views handed to comm
+
+	// with numa every node assigns its own range of the points, see setNuma
+	Numa* numa = nullptr;
+
+	// sparse datasets only: ||c||^2 of every center and K values of scratch per worker slot
+	// for nearestCenterSparse
+	vector<double> center_norms;
+	vector<double> sparse_dots;
+
+	// filled by run() and runMiniBatch() for report()
+	int iterations = 0;
+	long execution_time = 0, seeding_time = 0;
 
 	// return ID of nearest center (uses euclidean distance)
-	int getIDNearestCenter(Point point)
+	int getIDNearestCenter(const T* point)
 	{
-		double sum = 0.0, min_dist;
-		int id_cluster_center = 0;
+		return nearest_center(point, centroids.data(), K, stride, total_values);
+	}
 
-        // compute the Euclidean distance from each point to the center of the first cluster
-		for(int i = 0; i < total_values; i++)
-		{
-			sum += pow(clusters[0].getCentralValue(i) - point.getValue(i), 2.0);
+	// squared distance between a point and a center of the block read by the kernels
+	double distanceToCentroid(const T* point, int id_cluster)
+	{
+		double sum = 0.0;
+		for(int j = 0; j < total_values; j++) {
+			double diff = (double)centroids[j * stride + id_cluster] - point[j];
+			sum += diff * diff;
 		}
-		min_dist = sum;
-        
-        // compute the distance from the point to the center of each cluster
-		for(int i = 1; i < K; i++)
-		{
-			double dist;
-			sum = 0.0;
+		return sum;
+	}
 
-            // compute the Euclidean distance from each point to the center of the cluster
-			for(int j = 0; j < total_values; j++)
-			{
-				sum += pow(clusters[i].getCentralValue(j) - point.getValue(j), 2.0);
+	// add views[0, count) into the clusters and, with reset, clear every view. Every task
+	// owns a range of clusters, so the K x total_values sums are combined in parallel
+	// rather than view by view on the calling thread; a cluster that no point of a view
+	// touched is skipped for that view, and only the clusters that changed are marked
+	// stale for recomputeCenters(). With replace the views hold whole clusters rather than
+	// changes, and the previous sums are dropped first
+	void combineViews(vector<View>& views, int count, bool reset, bool replace = false)
+	{
+		tbb::parallel_for(tbb::blocked_range<int>(0, K),
+			[&](const tbb::blocked_range<int>& r) {
+				for(int j = r.begin(); j < r.end(); j++) {
+					if(replace) {
+						clusters[j].clear();
+						stale[j] = 1;
+					}
+					for(int v = 0; v < count; v++) {
+						if(views[v].isTouched(j)) {
+							clusters[j] += views[v];
+							stale[j] = 1;
+						}
+					}
+					for(int v = 0; v < (reset ? (int)views.size() : 0); v++) {
+						views[v].resetCluster(j);
+					}
+				}
 			}
-			dist = sum;
+		);
 
-            // if the distance is less than the minimum distance, update the minimum distance and the ID of the cluster center
-			if(dist < min_dist)
-			{
-				min_dist = dist;
-				id_cluster_center = i;
+		if(reset) {
+			for(auto& v : views) {
+				v.resetCounters();
 			}
 		}
+	}
 
-		return id_cluster_center;
+	// recalculate the center of every stale cluster and its column of the kernel block, in
+	// parallel, and its squared norm for a sparse dataset; the others keep the same sums and so
+	// the same center
+	void recomputeCenters()
+	{
+		tbb::parallel_for(tbb::blocked_range<int>(0, K),
+			[&](const tbb::blocked_range<int>& r) {
+				for(int i = r.begin(); i < r.end(); i++) {
+					if(!stale[i])
+						continue;
+					stale[i] = 0;
+					clusters[i].setCentralValues();
+					for(int j = 0; j < total_values; j++) {
+						centroids[j * stride + i] = (T)clusters[i].getCentralValue(j);
+					}
+					if(!center_norms.empty()) {
+						double norm = 0.0;
+						for(int j = 0; j < total_values; j++)
+							norm += (double)centroids[j * stride + i] * centroids[j * stride + i];
+						center_norms[i] = norm;
+					}
+				}
+			}
+		);
 	}
 
-public:
-	KMeans(int K, int total_points, int total_values, int max_iterations)
+	// a cluster seeded with point index, spread out of its columns for a sparse dataset
+	Cluster seedCluster(Dataset& dataset, int id_cluster, int index)
 	{
-		this->K = K;
-		this->total_points = total_points;
-		this->total_values = total_values;
-		this->max_iterations = max_iterations;
+		if(!dataset.isSparse())
+			return Cluster(id_cluster, dataset.getPoint(index), total_values);
+		vector<double> point(total_values);
+		dataset.densify(index, point.data());
+		return Cluster(id_cluster, point.data(), total_values);
 	}
 
-	void run(vector<Point> & points)
+	// pick the K initial centers and seed one cluster with each of them
+	void chooseCenters(Dataset& dataset)
 	{
+		vector<int> prohibited_indexes;
+		this->stale.assign(K, 1);
 
-		vector<std::chrono::microseconds> times1;
-		vector<std::chrono::microseconds> times2;
-        auto begin = chrono::high_resolution_clock::now();
-        
-		if(K > total_points)
-			return;
+		if(options.init == "kmeans++") {
+			prohibited_indexes = seedKMeansPlusPlus(dataset, K, options.seed);
+		} else if(options.init == "kmeans||") {
+			double oversampling = options.oversampling > 0 ? options.oversampling : 2.0 * K;
+			prohibited_indexes = seedKMeansParallel(dataset, K, options.seed, oversampling, options.rounds, seeding_center);
+		}
 
-		vector<int> prohibited_indexes;
+		for(int i = 0; i < (int)prohibited_indexes.size(); i++)
+		{
+			labels[prohibited_indexes[i]] = i;
+			clusters.push_back(seedCluster(dataset, i, prohibited_indexes[i]));
+		}
 
 		// choose K distinct values for the centers of the clusters
-		for(int i = 0; i < K; i++)
+		for(int i = clusters.size(); i < K; i++)
 		{
             srand(i); // seed the execution for now to standardize execution in testing
             // Stop the loop when a new cluster center is chosen
@@ -300,69 +542,610 @@ public:
 				if(find(prohibited_indexes.begin(), prohibited_indexes.end(), index_point) == prohibited_indexes.end())
 				{
 					prohibited_indexes.push_back(index_point);
-					points[index_point].setCluster(i);
-					Cluster cluster(i, points[index_point]);
-					clusters.push_back(cluster);
+					labels[index_point] = i;
+					clusters.push_back(seedCluster(dataset, i, index_point));
 					break;
 				}
 			}
 		}
+	}
+
+	void showClusters()
+	{
+		// shows elements of clusters
+		for(int i = 0; i < K; i++)
+		{
+			int total_points_cluster =  clusters[i].getTotalPoints();
+
+			// cout << "Cluster " << clusters[i].getID() + 1 << endl;
+			// for(int j = 0; j < total_points_cluster; j++)
+			// {
+			// 	cout << "Point " << clusters[i].getPoint(j).getID() + 1 << ": ";
+			// 	for(int p = 0; p < total_values; p++)
+			// 		cout << clusters[i].getPoint(j).getValue(p) << " ";
+
+			// 	string point_name = clusters[i].getPoint(j).getName();
+
+			// 	if(point_name != "")
+			// 		cout << "- " << point_name;
+
+			// 	cout << endl;
+			// }
+
+			cout << "Cluster values: ";
+
+			for(int j = 0; j < total_values; j++)
+				cout << clusters[i].getCentralValue(j) << " ";
+
+			cout << "\n\n";
+		}
+	}
+
+	// mean over the features of their variance, the scale the shift tolerance is relative to
+	double meanVariance(Dataset& dataset)
+	{
+		vector<double> moments = tbb::parallel_reduce(
+			tbb::blocked_range<int>(0, total_points), vector<double>(2 * total_values, 0.0),
+			[&](const tbb::blocked_range<int>& r, vector<double> sums) {
+				for(int i = r.begin(); i < r.end(); i++) {
+					if(dataset.isSparse()) {
+						// the zeros add nothing to either sum
+						const int32_t* columns = dataset.getColumns(i);
+						const double* entries = dataset.getEntries(i);
+						for(int e = 0; e < dataset.getEntryCount(i); e++) {
+							sums[columns[e]] += entries[e];
+							sums[total_values + columns[e]] += entries[e] * entries[e];
+						}
+						continue;
+					}
+					for(int j = 0; j < total_values; j++) {
+						double value = dataset.getValue(i, j);
+						sums[j] += value;
+						sums[total_values + j] += value * value;
+					}
+				}
+				return sums;
+			},
+			[](vector<double> a, const vector<double>& b) {
+				for(size_t j = 0; j < a.size(); j++)
+					a[j] += b[j];
+				return a;
+			}
+		);
+
+		double variance = 0.0;
+		for(int j = 0; j < total_values; j++) {
+			double mean = moments[j] / total_points;
+			variance += moments[total_values + j] / total_points - mean * mean;
+		}
+		return variance / total_values;
+	}
+
+public:
+	KMeans(int K, int total_points, int total_values, int max_iterations, const Options& options)
+	{
+		this->K = K;
+		this->total_points = total_points;
+		this->total_values = total_values;
+		this->max_iterations = max_iterations;
+
+		this->stride = centroidStride<T>(K);
+		this->centroids.assign((size_t)stride * total_values, INFINITY);
+		this->stale.assign(K, 1);
+		this->labels.assign(total_points, -1);
+		this->first_point = 0;
+		this->last_point = total_points;
+		this->options = options;
+		this->isa = options.isa;
+		this->nearest_center = selectNearestCenter<T>(total_values, this->isa);
+		this->seeding_center = selectNearestCenter(total_values, this->isa);
+
+		if(options.assignment == "elkan")
+			this->engine.reset(new Elkan(total_points, K, total_values));
+		else if(options.assignment == "hamerly")
+			this->engine.reset(new Hamerly(total_points, K, total_values));
+		else if(options.assignment == "yinyang")
+			this->engine.reset(new Yinyang(total_points, K, total_values, options.groups));
+
+		if(!options.telemetry.empty()) {
+			this->telemetry.open(options.telemetry);
+			if(!this->telemetry) {
+				std::cerr << "Unable to open " << options.telemetry;
+				exit(1);
+			}
+			this->telemetry.precision(10);
+		}
+	}
+
+	string getInstructionSet()
+	{
+		return this->isa;
+	}
+
+	void setQuiet(bool quiet)
+	{
+		this->quiet = quiet;
+	}
+
+	// own shard comm->getRank() of comm->getSize() equal runs of points and add the cluster
+	// sums of every shard together through comm on every iteration
+	void setShard(Allreduce* comm)
+	{
+		this->comm = comm;
+		pair<int, int> shard = shardRange(total_points, comm->getRank(), comm->getSize());
+		this->first_point = shard.first;
+		this->last_point = shard.second;
+		this->exchange.resize(View(K, total_values).packedSize());
+	}
+
+	// assign the points of every node of numa (its range of this shard, as placed by
+	// main) from the threads of that node, into views that live on the node; the views of
+	// a node are summed on the node and only the node totals cross nodes in combineViews.
+	// The labels move to pages written by the node of their points, and so do the bounds of
+	// the engines, which the first iteration writes from the node that assigns the point
+	void setNuma(Numa* numa)
+	{
+		this->numa = numa;
+		UntouchedVector<int> placed(total_points);
+		std::fill(placed.begin(), placed.begin() + first_point, -1);
+		std::fill(placed.begin() + last_point, placed.end(), -1);
+		numa->forEachNode([&](int node) {
+			pair<int, int> range = numa->getRange(node, first_point, last_point);
+			tbb::parallel_for(tbb::blocked_range<int>(range.first, range.second),
+				[&](const tbb::blocked_range<int>& r) {
+					std::fill(placed.begin() + r.begin(), placed.begin() + r.end(), -1);
+				}
+			);
+		});
+		this->labels.swap(placed);
+	}
+
+	// read the points of --assign gemm from gemm_points, shared with the other models of
+	// the same dataset, rather than from a copy built by run()
+	void setGemmPoints(shared_ptr<const GemmPoints<T>> gemm_points)
+	{
+		this->gemm_points = gemm_points;
+	}
+
+	// the K centers, row-major
+	vector<double> getCenters()
+	{
+		vector<double> centers((size_t)K * total_values);
+		for(int i = 0; i < K; i++) {
+			for(int j = 0; j < total_values; j++)
+				centers[(size_t)i * total_values + j] = clusters[i].getCentralValue(j);
+		}
+		return centers;
+	}
+
+	const UntouchedVector<int>& getLabels()
+	{
+		return this->labels;
+	}
+
+	int getIterations()
+	{
+		return this->iterations;
+	}
+
+	long getExecutionTime()
+	{
+		return this->execution_time;
+	}
+
+	// squared distance of every point to the center of its cluster
+	double getInertia(Dataset& dataset)
+	{
+		return tbb::parallel_reduce(tbb::blocked_range<int>(0, total_points), 0.0,
+			[&](const tbb::blocked_range<int>& r, double sum) {
+				for(int i = r.begin(); i < r.end(); i++)
+					sum += distanceToCentroid(dataset.getPointAs<T>(i), labels[i]);
+				return sum;
+			},
+			std::plus<double>()
+		);
+	}
+
+	// Start from the clusters of previous, a finished run over the same dataset with one
+	// cluster less, instead of chooseCenters(): the cluster with the largest inertia is split
+	// in two at the middle of the range of its feature of largest variance, and run() begins
+	// from the means of that partition. The kd-tree and the gemm copy of the points are
+	// taken over rather than rebuilt.
+	void warmStart(Dataset& dataset, KMeans<T>& previous)
+	{
+		int P = previous.K;
+		// per cluster: size, then the sum, the sum of squares, the minimum and the maximum of every feature
+		int width = 1 + 4 * total_values;
+		vector<double> identity((size_t)P * width, 0.0);
+		for(int c = 0; c < P; c++) {
+			std::fill(identity.begin() + (size_t)c * width + 1 + 2 * total_values, identity.begin() + (size_t)c * width + 1 + 3 * total_values, INFINITY);
+			std::fill(identity.begin() + (size_t)c * width + 1 + 3 * total_values, identity.begin() + (size_t)(c + 1) * width, -INFINITY);
+		}
+		vector<double> moments = tbb::parallel_reduce(
+			tbb::blocked_range<int>(0, total_points), identity,
+			[&](const tbb::blocked_range<int>& r, vector<double> sums) {
+				for(int i = r.begin(); i < r.end(); i++) {
+					double* m = sums.data() + (size_t)previous.labels[i] * width;
+					m[0] += 1;
+					for(int j = 0; j < total_values; j++) {
+						double value = dataset.getValue(i, j);
+						m[1 + j] += value;
+						m[1 + total_values + j] += value * value;
+						m[1 + 2 * total_values + j] = min(m[1 + 2 * total_values + j], value);
+						m[1 + 3 * total_values + j] = max(m[1 + 3 * total_values + j], value);
+					}
+				}
+				return sums;
+			},
+			[&](vector<double> a, const vector<double>& b) {
+				for(int c = 0; c < P; c++) {
+					double* x = a.data() + (size_t)c * width;
+					const double* y = b.data() + (size_t)c * width;
+					for(int j = 0; j < 1 + 2 * total_values; j++)
+						x[j] += y[j];
+					for(int j = 0; j < total_values; j++) {
+						x[1 + 2 * total_values + j] = min(x[1 + 2 * total_values + j], y[1 + 2 * total_values + j]);
+						x[1 + 3 * total_values + j] = max(x[1 + 3 * total_values + j], y[1 + 3 * total_values + j]);
+					}
+				}
+				return a;
+			}
+		);
+
+		// the inertia of a cluster is its size times the sum of the variances of its features;
+		// only clusters with two distinct values of some feature can be split
+		int split = -1, feature = 0;
+		double split_inertia = -1.0;
+		for(int c = 0; c < P; c++) {
+			const double* m = moments.data() + (size_t)c * width;
+			double inertia = 0.0, widest = -1.0;
+			int widest_feature = -1;
+			for(int j = 0; j < total_values && m[0] > 0; j++) {
+				double mean = m[1 + j] / m[0];
+				double variance = max(0.0, m[1 + total_values + j] / m[0] - mean * mean);
+				inertia += variance * m[0];
+				if(m[1 + 3 * total_values + j] > m[1 + 2 * total_values + j] && variance > widest) {
+					widest = variance;
+					widest_feature = j;
+				}
+			}
+			if(widest_feature != -1 && inertia > split_inertia) {
+				split = c;
+				split_inertia = inertia;
+				feature = widest_feature;
+			}
+		}
+
+		this->labels = previous.labels;
+		if(split != -1) {
+			const double* m = moments.data() + (size_t)split * width;
+			double middle = (m[1 + 2 * total_values + feature] + m[1 + 3 * total_values + feature]) / 2;
+			for(int i = 0; i < total_points; i++) {
+				if(labels[i] == split && dataset.getValue(i, feature) > middle)
+					labels[i] = K - 1;
+			}
+		}
+
+		// sum the clusters of the new partition
+		clusters.clear();
+		for(int c = 0; c < K; c++)
+			clusters.push_back(Cluster(c, total_values));
+		this->stale.assign(K, 1);
+		vector<View> views(tbb::this_task_arena::max_concurrency(), View(K, total_values));
+		tbb::parallel_for(tbb::blocked_range<int>(0, total_points),
+			[&](const tbb::blocked_range<int>& r) {
+				View& local_view = views[tbb::this_task_arena::current_thread_index()];
+				for(int i = r.begin(); i < r.end(); i++)
+					local_view.addPoint(dataset.getPoint(i), labels[i]);
+			}
+		);
+		combineViews(views, views.size(), false);
+
+		this->gemm_points = previous.gemm_points;
+		this->kdtree = previous.kdtree;
+		this->warm = true;
+	}
+
+	// replace views[0] with the sum of views[0, count) over every process and clear the others.
+	// Every process then adds the same sums to the same clusters, so they all keep the same centers
+	void exchangeViews(vector<View>& views, int count)
+	{
+		std::fill(exchange.begin(), exchange.end(), 0.0);
+		for(int v = 0; v < count; v++)
+			views[v].pack(exchange.data());
+		comm->sum(exchange.data(), exchange.size());
+		views[0].unpack(exchange.data());
+		for(int v = 1; v < count; v++)
+			views[v].reset();
+	}
+
+	// give every process the labels of the other shards
+	void gatherLabels()
+	{
+		vector<double> all(total_points, 0.0);
+		for(int i = first_point; i < last_point; i++)
+			all[i] = labels[i];
+		comm->sum(all.data(), all.size());
+		for(int i = 0; i < total_points; i++)
+			labels[i] = (int)all[i];
+	}
+
+	// print the iteration the run stopped in, its times and the centers
+	void report()
+	{
+		if(iterations == 0)
+			return;
+
+		cout << "Break in iteration " << iterations << "\n\n";
+		cout << "TOTAL EXECUTION TIME = " << execution_time << "\n\n";
+		if(options.init != "legacy")
+			cout << "SEEDING TIME = " << seeding_time << "\n\n";
+
+		showClusters();
+	}
+
+	// associate the points [begin, end) to their nearest center, recording the moves in view;
+	// slot is the worker slot of the calling thread, which owns a row of the engine scratch
+	void assignPoints(Dataset& dataset, int begin, int end, View& local_view, int slot, bool record)
+	{
+		long distances = 0;
+		double inertia = 0.0;
+		int gemm_ids[GEMM_TILE];
+		if(dataset.isSparse()) {
+			assignSparsePoints(dataset, begin, end, local_view, slot, record);
+			return;
+		}
+		for(int tile = begin; tile < end; tile += GEMM_TILE) {
+			int tile_end = min(end, tile + GEMM_TILE);
+			if(gemm)
+				gemm->nearest(dataset, tile, tile_end - tile, gemm_ids, centroids.data(), stride);
+
+			for(int i = tile; i < tile_end; i++) {
+
+				int id_old_cluster = labels[i]; // get the cluster designation of point i
+				int id_nearest_center; // calculate the nearest cluster by Euclidian distance of point i
+				if(gemm) {
+					id_nearest_center = gemm_ids[i - tile];
+				} else if(engine) {
+					id_nearest_center = engine->nearest(i, dataset.getPoint(i), id_old_cluster, slot, distances);
+				} else {
+					id_nearest_center = getIDNearestCenter(dataset.getPointAs<T>(i));
+				}
+				
+				// if the cluster is anything other than the nearest cluster, remove the point from the old cluster and add it to the nearest cluster
+				if(id_old_cluster != id_nearest_center) {
+					if(id_old_cluster != -1) {
+						local_view.removePoint(dataset.getPoint(i), id_old_cluster);
+					}
+				labels[i] = id_nearest_center; // assign the point to a cluster
+				local_view.addPoint(dataset.getPoint(i), id_nearest_center); //add the point to the nearest cluster
+
+				}
+				if(record)
+					inertia += distanceToCentroid(dataset.getPointAs<T>(i), id_nearest_center);
+			}
+		}
+		local_view.addDistances(distances);
+		local_view.addInertia(inertia);
+	}
+
+	// assignPoints for a sparse dataset: the distances come from nearestCenterSparse and the
+	// moves are scattered into the columns of the nonzero values only
+	void assignSparsePoints(Dataset& dataset, int begin, int end, View& local_view, int slot, bool record)
+	{
+		double inertia = 0.0;
+		double* dots = sparse_dots.data() + (size_t)slot * K;
+		for(int i = begin; i < end; i++) {
+			const int32_t* columns = dataset.getColumns(i);
+			const double* entries = dataset.getEntries(i);
+			int count = dataset.getEntryCount(i);
+			double distance;
+			int id_old_cluster = labels[i];
+			int id_nearest_center = nearestCenterSparse(columns, entries, count, dataset.getNorm(i),
+				centroids.data(), center_norms.data(), K, stride, dots, distance);
+
+			if(id_old_cluster != id_nearest_center) {
+				if(id_old_cluster != -1)
+					local_view.removeSparse(columns, entries, count, id_old_cluster);
+				labels[i] = id_nearest_center;
+				local_view.addSparse(columns, entries, count, id_nearest_center);
+			}
+			inertia += distance;
+		}
+		if(record)
+			local_view.addInertia(inertia);
+	}
+
+	// merge every view into views[0] pairwise: views[b] takes views[b + step] for
+	// step = 1, 2, 4, ..., a shape that only depends on the number of views
+	static void mergeTree(vector<View>& views)
+	{
+		int n = views.size();
+		for(int step = 1; step < n; step *= 2) {
+			tbb::parallel_for(tbb::blocked_range<int>(0, (n + 2 * step - 1) / (2 * step), 1),
+				[&](const tbb::blocked_range<int>& r) {
+					for(int i = r.begin(); i < r.end(); i++) {
+						int b = i * 2 * step;
+						if(b + step < n)
+							views[b].merge(views[b + step]);
+					}
+				}
+			);
+		}
+	}
+
+	// Besides the fixed point (no point changes cluster) and the iteration limit, the loop stops
+	// at the first iteration past the first one that meets any of the tolerances set:
+	//   tol_inertia, the inertia improved by no more than this fraction of the previous one,
+	//   tol_shift, no center moved by more than this times the mean feature variance (squared),
+	//   tol_changed, no more than this fraction of the points changed cluster.
+	// With any of them set, every iteration prints its inertia, max shift and changed fraction.
+	//
+	// With a telemetry file, every iteration appends one JSON line:
+	//   iteration, assign_us (point loop), reduce_us (merging the thread local views or the blocks),
+	//   update_us (new centers and engine bounds), changed (points that switched cluster),
+	//   inertia (sum of squared distances to the centers the points were compared with)
+	//   and max_shift (largest distance a center moved before the point loop).
+	// The timers are read a few times per iteration and the inertia costs one distance
+	// per point, so it can be left on.
+	void run(Dataset& dataset)
+	{
+        auto begin = chrono::high_resolution_clock::now();
+        
+		if(K > total_points)
+			return;
+
+		if(!warm)
+			chooseCenters(dataset);
         auto end_phase1 = chrono::high_resolution_clock::now();
         
+		// built here as they keep their own copy of the points, unless a warm start or
+		// setGemmPoints() passed them on
+		if(options.assignment == "gemm") {
+			if(!gemm_points)
+				this->gemm_points = make_shared<const GemmPoints<T>>(dataset);
+			this->gemm.reset(new Gemm<T>(gemm_points, K, total_values, this->isa, this->nearest_center));
+		}
+		if(options.assignment == "kdtree") {
+			if(kdtree)
+				this->kdtree->setK(K);
+			else
+				this->kdtree = make_shared<KdTree>(dataset, K);
+		}
+
+		// worker slots of the point loop: those of the arena, or with numa those of every node
+		// arena, node after node, so threads of different nodes never share a slot
+		int slots = tbb::this_task_arena::max_concurrency();
+		vector<int> node_slots(numa ? numa->getTotalNodes() : 0);
+		if(numa) {
+			slots = 0;
+			for(int node = 0; node < numa->getTotalNodes(); node++) {
+				node_slots[node] = slots;
+				slots += numa->getConcurrency(node);
+			}
+		}
+		if(engine)
+			engine->reserveSlots(slots);
+		if(dataset.isSparse()) {
+			this->center_norms.assign(K, 0.0);
+			this->sparse_dots.assign((size_t)slots * K, 0.0);
+		}
+
 		int iter = 1;
-		//tbb::enumerable_thread_specific<vector<Cluster>> cluster_tls(clusters.begin(), clusters.end());
-		tbb::enumerable_thread_specific<int> id_old_cluster_tls;
-		tbb::enumerable_thread_specific<int> id_nearest_center_tls;
-		tbb::enumerable_thread_specific<View> tls_views;
+		// one View per worker slot of the arena, indexed by current_thread_index(). Unlike
+		// enumerable_thread_specific, every view is built here, so a thread joining in a
+		// later iteration does not allocate one on the fly.
+		// In deterministic mode there is one View per block of DETERMINISTIC_BLOCK points
+		// instead, filled in point order by a single task and merged by mergeTree(), so the
+		// sums do not depend on the number of threads or on how TBB splits the range; only
+		// views[0], which holds the merged total, is read afterwards.
+		// with comm only the shard of this process is assigned, and exchangeViews() adds up the shards
+		bool deterministic = options.deterministic;
+		int total_blocks = (last_point - first_point + DETERMINISTIC_BLOCK - 1) / DETERMINISTIC_BLOCK;
+		// with numa views holds one total per node, summed from node_views, the views of the
+		// worker slots of every node arena, which are built by the node itself
+		int total_views = deterministic ? total_blocks : numa ? numa->getTotalNodes() : tbb::this_task_arena::max_concurrency();
+		vector<View> views(total_views, View(K, total_values));
+		int reduced_views = deterministic ? 1 : views.size();
+		vector<vector<View>> node_views(numa ? numa->getTotalNodes() : 0);
+		if(numa) {
+			numa->forEachNode([&](int node) {
+				node_views[node].assign(numa->getConcurrency(node), View(K, total_values));
+			});
+			// the points, their labels and the engine bounds stay on their node; every node other
+			// than the first reads the centroid block and the per center state of the engine, and
+			// hands its total over
+			size_t center_bytes = centroids.size() * sizeof(T) + (engine ? engine->getCenterBytes() : 0);
+			if(!quiet)
+				cout << "NUMA NODES = " << numa->getTotalNodes() << ", CROSS NODE BYTES PER ITERATION = "
+					<< (numa->getTotalNodes() - 1) * (views[0].packedSize() * sizeof(double) + center_bytes) << "\n\n";
+		}
 		bool not_done = true;
+		bool tolerances = options.tol_inertia >= 0 || options.tol_shift >= 0 || options.tol_changed >= 0;
+		bool record = telemetry.is_open() || tolerances;
+		double shift_threshold = options.tol_shift >= 0 ? options.tol_shift * meanVariance(dataset) : -1;
+		double previous_inertia = 0.0;
+		vector<T, tbb::cache_aligned_allocator<T>> previous(record ? centroids.size() : 0);
 	
         // Stop the loop when the maximum number of iterations is reached or the points are assigned to the nearest cluster center
 		do
 		{
-			// resolve intermediate cluster sums to global cluster sums	
-			for(auto i = tls_views.begin(); i != tls_views.end(); i++) {
-				View v = *i;
-				for(int j = 0; j < K; j++) {
-					clusters[j] += v;
-				}
-			}
-
-			for(auto& v : tls_views) {
-				v.reset();
-			}	
+#ifdef COUNT_ALLOCATIONS
+			size_t allocations_before = allocationCount();
+#endif
+			auto begin_reduce = chrono::high_resolution_clock::now();
+
+			// resolve intermediate cluster sums to global cluster sums; the blocks of the
+			// deterministic mode are reset by the task that fills them. The kd-tree walk
+			// sums every cluster from scratch, except on the first iteration where the
+			// clusters only hold their seed
+			combineViews(views, reduced_views, !deterministic, kdtree && iter > 1);
+			auto end_reduce = chrono::high_resolution_clock::now();
 
 			// recalculating the center of each cluster
-			for(int i = 0; i < K; i++) {
-				clusters[i].setCentralValues();
+			if(record)
+				std::copy(centroids.begin(), centroids.end(), previous.begin());
+			recomputeCenters();
+			if(gemm)
+				gemm->update(centroids.data(), stride);
+			// the engines only work on float64 coordinates, main() rejects them otherwise
+			if constexpr (is_same<T, double>::value) {
+				if(engine)
+					engine->update(centroids.data(), stride);
+				if(kdtree)
+					kdtree->update(centroids.data(), stride);
 			}
 
 			// associates each point to the nearest center
-			auto end_phase2 = chrono::high_resolution_clock::now();
-			tbb::parallel_for(tbb::blocked_range<size_t>(0, total_points),
-				[&](tbb::blocked_range<size_t>& r) {
-					for(int i = r.begin(); i < r.end(); i++) {
-
-						id_old_cluster_tls.local() = points[i].getCluster(); // get the cluster designation of point i
-						id_nearest_center_tls.local() = getIDNearestCenter(points[i]); // calculate the nearest cluster by Euclidian distance of point i
-						
-						// if the cluster is anything other than the nearest cluster, remove the point from the old cluster and add it to the nearest cluster
-						if(id_old_cluster_tls.local() != id_nearest_center_tls.local()) {
-							if(id_old_cluster_tls.local() != -1) {
-								tls_views.local().removePoint(points[i], id_old_cluster_tls.local());
-							}
-						points[i].setCluster(id_nearest_center_tls.local()); // assign the point to a cluster
-						tls_views.local().addPoint(points[i], id_nearest_center_tls.local()); //add the point to the nearest cluster
-
+			auto end_update = chrono::high_resolution_clock::now();
+			if(kdtree) {
+				if constexpr (is_same<T, double>::value)
+					kdtree->assign(labels.data(), views, record);
+			} else if(deterministic) {
+				tbb::parallel_for(tbb::blocked_range<int>(0, views.size(), 1),
+					[&](const tbb::blocked_range<int>& r) {
+						for(int b = r.begin(); b < r.end(); b++) {
+							views[b].reset();
+							int begin_block = first_point + b * DETERMINISTIC_BLOCK;
+							assignPoints(dataset, begin_block, min(last_point, begin_block + DETERMINISTIC_BLOCK), views[b],
+								tbb::this_task_arena::current_thread_index(), record);
 						}
 					}
-				}
-			);
+				);
+			} else if(numa) {
+				numa->forEachNode([&](int node) {
+					pair<int, int> range = numa->getRange(node, first_point, last_point);
+					vector<View>& local = node_views[node];
+					tbb::parallel_for(tbb::blocked_range<int>(range.first, range.second),
+						[&](const tbb::blocked_range<int>& r) {
+							int slot = tbb::this_task_arena::current_thread_index();
+							assignPoints(dataset, r.begin(), r.end(), local[slot], node_slots[node] + slot, record);
+						}
+					);
+					for(View& v : local) {
+						views[node].merge(v);
+						v.reset();
+					}
+				});
+			} else {
+				tbb::parallel_for(tbb::blocked_range<int>(first_point, last_point),
+					[&](const tbb::blocked_range<int>& r) {
+						int slot = tbb::this_task_arena::current_thread_index();
+						assignPoints(dataset, r.begin(), r.end(), views[slot], slot, record);
+					}
+				);
+			}
 
-			auto end_phase3 = chrono::high_resolution_clock::now();
+			auto end_assign = chrono::high_resolution_clock::now();
+			if(deterministic)
+				mergeTree(views);
+			if(comm)
+				exchangeViews(views, reduced_views);
+			auto end_merge = chrono::high_resolution_clock::now();
 
 			// resolve change count and reset cluster_change_tls
-			for (auto i = tls_views.begin(); i != tls_views.end(); ++i) {
-				View v = *i;
+			for (auto i = views.begin(); i != views.begin() + reduced_views; ++i) {
+				const View& v = *i;
 				int s = v.getChange();
 				if (s > 0) {
 					not_done = true;
@@ -371,101 +1154,626 @@ public:
 				not_done = false;
 			}
 
-			if(not_done == false || iter >= max_iterations)
-			{
-				cout << "Break in iteration " << iter << "\n\n";
-				break;
+			// report how much work the bounds saved
+			if((engine || kdtree) && !quiet) {
+				long distances = 0;
+				for(int v = 0; v < reduced_views; v++) {
+					distances += views[v].getDistances();
+				}
+				long total_distances = (long)total_points * K;
+				cout << "Iteration " << iter << ": skipped " << total_distances - distances << " of " << total_distances << " distance calculations\n";
+			}
+
+			bool converged = false;
+			if(record) {
+				long changed = 0;
+				double inertia = 0.0;
+				for(int v = 0; v < reduced_views; v++) {
+					changed += views[v].getChange();
+					inertia += views[v].getInertia();
+				}
+				double max_shift = 0.0;
+				for(int i = 0; i < K && iter > 1; i++) {
+					double shift = 0.0;
+					for(int j = 0; j < total_values; j++) {
+						double diff = (double)centroids[j * stride + i] - previous[j * stride + i];
+						shift += diff * diff;
+					}
+					max_shift = max(max_shift, sqrt(shift));
+				}
+
+				if(tolerances) {
+					double changed_fraction = (double)changed / total_points;
+					if(!quiet)
+						cout << "Iteration " << iter << ": inertia " << inertia << ", max shift " << max_shift
+							<< ", changed " << changed_fraction << "\n";
+					if(iter > 1) {
+						converged = (options.tol_inertia >= 0 && previous_inertia - inertia <= options.tol_inertia * previous_inertia)
+							|| (shift_threshold >= 0 && max_shift * max_shift <= shift_threshold)
+							|| (options.tol_changed >= 0 && changed_fraction <= options.tol_changed);
+					}
+					previous_inertia = inertia;
+				}
+
+				if(telemetry.is_open())
+					telemetry << "{\"iteration\": " << iter
+						<< ", \"assign_us\": " << chrono::duration_cast<chrono::microseconds>(end_assign - end_update).count()
+						<< ", \"reduce_us\": " << chrono::duration_cast<chrono::microseconds>(end_reduce - begin_reduce + end_merge - end_assign).count()
+						<< ", \"update_us\": " << chrono::duration_cast<chrono::microseconds>(end_update - end_reduce).count()
+						<< ", \"changed\": " << changed
+						<< ", \"inertia\": " << inertia
+						<< ", \"max_shift\": " << max_shift << "}\n";
 			}
 
+#ifdef COUNT_ALLOCATIONS
+			// the first iteration may still warm up TBB, every later one must stay off the heap;
+			// restarts running side by side allocate during each other's iterations, and so do
+			// the task groups that start the nodes of numa
+			size_t allocations = allocationCount() - allocations_before;
+			if(iter > 1 && allocations != 0 && !quiet && !numa) {
+				std::cerr << allocations << " heap allocations in iteration " << iter << "\n";
+				exit(1);
+			}
+#endif
+
+			if(not_done == false || converged || iter >= max_iterations)
+				break;
+
 			iter++;
 		} while(not_done);
+		if(comm && !options.labels.empty())
+			gatherLabels();
         auto end = chrono::high_resolution_clock::now();
 
-		cout << "TOTAL EXECUTION TIME = "<<std::chrono::duration_cast<std::chrono::microseconds>(end-begin).count()<<"\n\n";
+		this->iterations = iter;
+		this->execution_time = chrono::duration_cast<chrono::microseconds>(end - begin).count();
+		this->seeding_time = chrono::duration_cast<chrono::microseconds>(end_phase1 - begin).count();
+	}
 
-		// shows elements of clusters
-		for(int i = 0; i < K; i++)
-		{
-			int total_points_cluster =  clusters[i].getTotalPoints();
+	// Mini-batch k-means: every iteration assigns options.batch_size points drawn at random
+	// (in parallel, through the same thread local views) and moves every center toward the mean
+	// of its batch points with a learning rate of batch points / points seen so far. Since the
+	// views only ever add points, the cluster sums are cumulative and setCentralValues() is
+	// exactly that update. It stops once no center moves by more than options.tol_shift times
+	// the mean variance of the features (squared distance).
+	void runMiniBatch(Dataset& dataset)
+	{
+        auto begin = chrono::high_resolution_clock::now();
 
-			// cout << "Cluster " << clusters[i].getID() + 1 << endl;
-			// for(int j = 0; j < total_points_cluster; j++)
-			// {
-			// 	cout << "Point " << clusters[i].getPoint(j).getID() + 1 << ": ";
-			// 	for(int p = 0; p < total_values; p++)
-			// 		cout << clusters[i].getPoint(j).getValue(p) << " ";
+		if(K > total_points)
+			return;
 
-			// 	string point_name = clusters[i].getPoint(j).getName();
+		chooseCenters(dataset);
+		recomputeCenters();
+        auto end_phase1 = chrono::high_resolution_clock::now();
 
-			// 	if(point_name != "")
-			// 		cout << "- " << point_name;
+		double tol_shift = options.tol_shift >= 0 ? options.tol_shift : 1e-4;
+		double threshold = tol_shift * meanVariance(dataset);
+		int batch_size = options.batch_size;
+		vector<int> batch(batch_size);
+		vector<T, tbb::cache_aligned_allocator<T>> previous(centroids.size());
+		vector<View> tls_views(tbb::this_task_arena::max_concurrency(), View(K, total_values));
 
-			// 	cout << endl;
-			// }
+		int iter = 1;
+		while(true)
+		{
+			// sample the batch, with replacement
+			for(int b = 0; b < batch_size; b++) {
+				batch[b] = (int)(seedUniform(options.seed, MINIBATCH_STREAM, (uint64_t)iter * batch_size + b) * total_points);
+			}
 
-			cout << "Cluster values: ";
+			// associates each batch point to the nearest center
+			tbb::parallel_for(tbb::blocked_range<int>(0, batch_size),
+				[&](tbb::blocked_range<int>& r) {
+					View& local_view = tls_views[tbb::this_task_arena::current_thread_index()];
+					for(int b = r.begin(); b < r.end(); b++) {
+						int index = batch[b];
+						local_view.addPoint(dataset.getPoint(index), getIDNearestCenter(dataset.getPointAs<T>(index)));
+					}
+				}
+			);
 
-			for(int j = 0; j < total_values; j++)
-				cout << clusters[i].getCentralValue(j) << " ";
+			combineViews(tls_views, tls_views.size(), true);
 
-			cout << "\n\n";
-            // cout << "TIME PHASE 1 = "<<std::chrono::duration_cast<std::chrono::microseconds>(end_phase1-begin).count()<<"\n";
-            
-            // cout << "TIME PHASE 2 = "<<std::chrono::duration_cast<std::chrono::microseconds>(end-end_phase1).count()<<"\n";
+			// recalculating the center of each cluster and how far it moved
+			std::copy(centroids.begin(), centroids.end(), previous.begin());
+			recomputeCenters();
 
-			// cout << "TIME PHASE ASSOCIATE = " << time_phase_associate.count() << endl;
-			// cout << "TIME PHASE RECALCULATE = " <<  time_phase_recalculate.count() << endl;
+			double max_shift = 0.0;
+			for(int i = 0; i < K; i++) {
+				double shift = 0.0;
+				for(int j = 0; j < total_values; j++) {
+					double diff = (double)centroids[j * stride + i] - previous[j * stride + i];
+					shift += diff * diff;
+				}
+				max_shift = max(max_shift, shift);
+			}
+
+			if(max_shift <= threshold || iter >= max_iterations)
+				break;
+
+			iter++;
 		}
+
+		// label every point against the final centers
+		tbb::parallel_for(tbb::blocked_range<int>(0, total_points),
+			[&](tbb::blocked_range<int>& r) {
+				for(int i = r.begin(); i < r.end(); i++) {
+					labels[i] = getIDNearestCenter(dataset.getPointAs<T>(i));
+				}
+			}
+		);
+        auto end = chrono::high_resolution_clock::now();
+
+		this->iterations = iter;
+		this->execution_time = chrono::duration_cast<chrono::microseconds>(end - begin).count();
+		this->seeding_time = chrono::duration_cast<chrono::microseconds>(end_phase1 - begin).count();
 	}
 };
 
+// run kmeans-parallel with coordinates of type T and write the labels if asked to. With
+// options.n_init > 1 the restarts, seeded options.seed, options.seed + 1, ..., are tasks
+// of the arena that each run their own parallel loops over the shared dataset; every
+// restart is printed in a table and only the one with the lowest inertia is reported.
+// Their telemetry goes to options.telemetry.1, .2, ...
+// With comm, the only model runs on the shard of this process (see KMeans::setShard).
+// With numa, the model assigns the points of every node on that node (see KMeans::setNuma).
+template<typename T>
+void cluster(Dataset& dataset, const Options& options, Allreduce* comm, Numa* numa)
+{
+	int K = options.K > 0 ? options.K : dataset.getK();
+	int restarts = options.n_init;
+	vector<unique_ptr<KMeans<T>>> models(restarts);
+	vector<double> inertia(restarts);
+	for(int r = 0; r < restarts; r++) {
+		Options restart = options;
+		restart.seed = options.seed + r;
+		if(restarts > 1 && !options.telemetry.empty())
+			restart.telemetry = options.telemetry + "." + to_string(r + 1);
+		models[r].reset(new KMeans<T>(K, dataset.getTotalPoints(), dataset.getTotalValues(), dataset.getMaxIterations(), restart));
+		models[r]->setQuiet(restarts > 1);
+		if(comm)
+			models[r]->setShard(comm);
+		if(numa)
+			models[r]->setNuma(numa);
+	}
+
+	auto begin = chrono::high_resolution_clock::now();
+	// the gemm copy of the points does not depend on the seed, so the restarts share one
+	if(options.assignment == "gemm" && options.batch_size == 0 && K <= dataset.getTotalPoints()) {
+		auto gemm_points = make_shared<const GemmPoints<T>>(dataset);
+		for(auto& model : models)
+			model->setGemmPoints(gemm_points);
+	}
+	tbb::parallel_for(tbb::blocked_range<int>(0, restarts, 1),
+		[&](const tbb::blocked_range<int>& range) {
+			for(int r = range.begin(); r < range.end(); r++) {
+				// a worker waiting on the loops of this restart must not pick up a whole other
+				// restart, which would stall this one and skew its time
+				tbb::this_task_arena::isolate([&] {
+					if(options.batch_size > 0)
+						models[r]->runMiniBatch(dataset);
+					else
+						models[r]->run(dataset);
+					// K > total points leaves the model unrun
+					if(restarts > 1)
+						inertia[r] = models[r]->getIterations() > 0 ? models[r]->getInertia(dataset) : INFINITY;
+				});
+			}
+		}
+	);
+	auto end = chrono::high_resolution_clock::now();
+
+	int best = 0;
+	if(restarts > 1) {
+		for(int r = 0; r < restarts; r++) {
+			cout << "Restart " << r + 1 << ": seed " << options.seed + r << ", " << models[r]->getIterations()
+				<< " iterations, " << models[r]->getExecutionTime() << " us, inertia " << inertia[r] << "\n";
+			if(inertia[r] < inertia[best])
+				best = r;
+		}
+		cout << "Best restart " << best + 1 << "\n\n";
+		cout << "RESTARTS TIME = " << chrono::duration_cast<chrono::microseconds>(end - begin).count() << "\n\n";
+	}
+	KMeans<T>& kmeans = *models[best];
+	kmeans.report();
+
+	if(!options.labels.empty() && (!comm || comm->getRank() == 0)) {
+		ofstream labels(options.labels);
+		if(!labels) {
+			std::cerr << "Unable to open " << options.labels;
+			exit(1);
+		}
+		for(int i = 0; i < dataset.getTotalPoints(); i++)
+			labels << kmeans.getLabels()[i] << "\n";
+	}
+
+	// K > total points leaves the model without centers
+	if(!options.centroids.empty() && kmeans.getIterations() > 0 && (!comm || comm->getRank() == 0)) {
+		if(!saveCentroids(options.centroids, kmeans.getCenters(), K, dataset.getTotalValues())) {
+			std::cerr << "Unable to write " << options.centroids;
+			exit(1);
+		}
+	}
+}
+
+// run kmeans-parallel for every K of [options.k_from, options.k_to], each K warm started
+// from the result of the previous one (see KMeans::warmStart), and print the iterations,
+// time and inertia of every K. The telemetry of K goes to options.telemetry.K
+template<typename T>
+void sweep(Dataset& dataset, const Options& options)
+{
+	unique_ptr<KMeans<T>> previous;
+	auto begin = chrono::high_resolution_clock::now();
+	for(int K = options.k_from; K <= options.k_to; K++) {
+		Options step = options;
+		if(!options.telemetry.empty())
+			step.telemetry = options.telemetry + "." + to_string(K);
+
+		auto begin_k = chrono::high_resolution_clock::now();
+		unique_ptr<KMeans<T>> kmeans(new KMeans<T>(K, dataset.getTotalPoints(), dataset.getTotalValues(), dataset.getMaxIterations(), step));
+		kmeans->setQuiet(true);
+		if(previous)
+			kmeans->warmStart(dataset, *previous);
+		kmeans->run(dataset);
+		auto end_k = chrono::high_resolution_clock::now();
+
+		// K > total points leaves the model unrun
+		if(kmeans->getIterations() == 0)
+			break;
+		cout << "K " << K << ": " << kmeans->getIterations() << " iterations, "
+			<< chrono::duration_cast<chrono::microseconds>(end_k - begin_k).count() << " us, inertia "
+			<< kmeans->getInertia(dataset) << "\n";
+		previous = move(kmeans);
+	}
+	auto end = chrono::high_resolution_clock::now();
+
+	cout << "\nSWEEP TIME = " << chrono::duration_cast<chrono::microseconds>(end - begin).count() << "\n\n";
+}
+
+// kmeans-parallel predict CENTROIDS DATAFILE [options]: label every point of the dataset with
+// its nearest center of a --centroids file, in batches of --batch points whose labels and
+// squared distances go to buffers handed to Predictor::predict, then written to --labels
+// and --distances. Prints the time spent in predict and the points per second.
+int predict(int argc, char *argv[])
+{
+	if(argc < 4) {
+		std::cerr << "Usage: kmeans-parallel predict centroids.txt datafile [--labels FILE] [--distances FILE] [--batch N] [--isa ISA] [--threads N]";
+		exit(1);
+	}
+
+	string labels_file, distances_file, isa = "auto";
+	int batch = 1 << 20, threads = 0;
+	for(int i = 4; i < argc; i++) {
+		string arg = argv[i];
+		if(arg == "--labels" && i + 1 < argc) {
+			labels_file = argv[++i];
+		} else if(arg == "--distances" && i + 1 < argc) {
+			distances_file = argv[++i];
+		} else if(arg == "--batch" && i + 1 < argc) {
+			batch = atoi(argv[++i]);
+		} else if(arg == "--isa" && i + 1 < argc) {
+			isa = argv[++i];
+		} else if(arg == "--threads" && i + 1 < argc) {
+			threads = atoi(argv[++i]);
+		} else {
+			std::cerr << "Unknown option " << arg;
+			exit(1);
+		}
+	}
+	if(batch < 1) {
+		std::cerr << "--batch must be at least 1";
+		exit(1);
+	}
+	if(isa != "auto" && isa != "scalar" && isa != "sse4.2" && isa != "avx2" && isa != "avx512") {
+		std::cerr << "Unknown instruction set " << isa;
+		exit(1);
+	}
+
+	vector<double> centers;
+	int K, total_values;
+	if(!loadCentroids(argv[2], centers, K, total_values)) {
+		std::cerr << "Unable to read centroids from " << argv[2];
+		exit(1);
+	}
+
+	auto begin_load = chrono::high_resolution_clock::now();
+	Dataset dataset;
+	if (!dataset.open(argv[3])) {
+		std::cerr << "Unable to open " << argv[3] << ": " << dataset.getError();
+		exit(1);
+	}
+	if(dataset.getTotalValues() != total_values) {
+		std::cerr << "The dataset has " << dataset.getTotalValues() << " values per point, the centroids " << total_values;
+		exit(1);
+	}
+	auto end_load = chrono::high_resolution_clock::now();
+	cout << "LOAD TIME = " << chrono::duration_cast<chrono::microseconds>(end_load - begin_load).count() << "\n\n";
+
+	ofstream labels, distances;
+	if(!labels_file.empty())
+		labels.open(labels_file);
+	if(!distances_file.empty()) {
+		distances.open(distances_file);
+		distances.precision(17);
+	}
+	if((!labels_file.empty() && !labels) || (!distances_file.empty() && !distances)) {
+		std::cerr << "Unable to open " << (labels ? distances_file : labels_file);
+		exit(1);
+	}
+
+	if(threads <= 0)
+		threads = tbb::this_task_arena::max_concurrency();
+	tbb::global_control control(tbb::global_control::max_allowed_parallelism, threads);
+	tbb::task_arena arena(threads);
+
+	Predictor predictor(centers, K, total_values, isa);
+	int total_points = dataset.getTotalPoints();
+	vector<int> batch_labels(min(batch, max(total_points, 1)));
+	vector<double> batch_distances(batch_labels.size());
+	long predict_time = 0;
+	for(int first = 0; first < total_points; first += batch) {
+		int count = min(batch, total_points - first);
+		auto begin = chrono::high_resolution_clock::now();
+		arena.execute([&] {
+			predictor.predict(dataset, first, count, batch_labels.data(), distances.is_open() ? batch_distances.data() : nullptr);
+		});
+		auto end = chrono::high_resolution_clock::now();
+		predict_time += chrono::duration_cast<chrono::microseconds>(end - begin).count();
+
+		for(int i = 0; i < count && labels.is_open(); i++)
+			labels << batch_labels[i] << "\n";
+		for(int i = 0; i < count && distances.is_open(); i++)
+			distances << batch_distances[i] << "\n";
+	}
+
+	cout << "PREDICT TIME = " << predict_time << "\n\n";
+	cout << "POINTS PER SECOND = " << (long)(total_points / max(predict_time * 1e-6, 1e-6)) << " (" << predictor.getInstructionSet() << ")\n\n";
+	return 0;
+}
+
 int main(int argc, char *argv[])
 {
-	int total_points, total_values, K, max_iterations, has_name;
+	if(argc > 1 && string(argv[1]) == "predict")
+		return predict(argc, argv);
+	if(argc < 2) {
+		std::cerr << "Usage: kmeans-parallel datafile [options] or kmeans-parallel predict centroids.txt datafile [options]";
+		exit(1);
+	}
 
 	string filename = argv[1];
-	ifstream inputFile(filename);
 
-	if (!inputFile) {
-		std::cerr << "Unable to open file";
+	// optional flags after the dataset file
+	Options options;
+	for(int i = 2; i < argc; i++) {
+		string arg = argv[i];
+		if(arg == "--isa" && i + 1 < argc) {
+			options.isa = argv[++i];
+		} else if(arg == "--assign" && i + 1 < argc) {
+			options.assignment = argv[++i];
+		} else if(arg == "--groups" && i + 1 < argc) {
+			options.groups = atoi(argv[++i]);
+		} else if(arg == "--k" && i + 1 < argc) {
+			options.K = atoi(argv[++i]);
+		} else if(arg == "--init" && i + 1 < argc) {
+			options.init = argv[++i];
+		} else if(arg == "--seed" && i + 1 < argc) {
+			options.seed = strtoull(argv[++i], nullptr, 10);
+		} else if(arg == "--oversampling" && i + 1 < argc) {
+			options.oversampling = atof(argv[++i]);
+		} else if(arg == "--rounds" && i + 1 < argc) {
+			options.rounds = atoi(argv[++i]);
+		} else if(arg == "--minibatch" && i + 1 < argc) {
+			options.batch_size = atoi(argv[++i]);
+		} else if(arg == "--tol-shift" && i + 1 < argc) {
+			options.tol_shift = atof(argv[++i]);
+		} else if(arg == "--tol-inertia" && i + 1 < argc) {
+			options.tol_inertia = atof(argv[++i]);
+		} else if(arg == "--tol-changed" && i + 1 < argc) {
+			options.tol_changed = atof(argv[++i]);
+		} else if(arg == "--telemetry" && i + 1 < argc) {
+			options.telemetry = argv[++i];
+		} else if(arg == "--precision" && i + 1 < argc) {
+			options.precision = argv[++i];
+		} else if(arg == "--labels" && i + 1 < argc) {
+			options.labels = argv[++i];
+		} else if(arg == "--centroids" && i + 1 < argc) {
+			options.centroids = argv[++i];
+		} else if(arg == "--deterministic") {
+			options.deterministic = true;
+		} else if(arg == "--k-sweep" && i + 1 < argc) {
+			if(sscanf(argv[++i], "%d:%d", &options.k_from, &options.k_to) != 2 || options.k_from < 1 || options.k_to < options.k_from) {
+				std::cerr << "--k-sweep takes FROM:TO with 1 <= FROM <= TO";
+				exit(1);
+			}
+		} else if(arg == "--processes" && i + 1 < argc) {
+			options.processes = atoi(argv[++i]);
+		} else if(arg == "--transport" && i + 1 < argc) {
+			options.transport = argv[++i];
+		} else if(arg == "--rank" && i + 1 < argc) {
+			options.rank = atoi(argv[++i]);
+		} else if(arg == "--endpoint" && i + 1 < argc) {
+			options.endpoint = argv[++i];
+		} else if(arg == "--n-init" && i + 1 < argc) {
+			options.n_init = atoi(argv[++i]);
+		} else if(arg == "--numa") {
+			options.numa = true;
+		} else if(arg == "--threads" && i + 1 < argc) {
+			options.threads = atoi(argv[++i]);
+		} else {
+			std::cerr << "Unknown option " << arg;
+			exit(1);
+		}
+	}
+
+	string& isa = options.isa;
+	if(isa != "auto" && isa != "scalar" && isa != "sse4.2" && isa != "avx2" && isa != "avx512") {
+		std::cerr << "Unknown instruction set " << isa;
 		exit(1);
 	}
 
-	inputFile >> total_points;
-	inputFile >> total_values;
-	inputFile >> K;
-	inputFile >> max_iterations;
-	inputFile >> has_name;
+	string& assignment = options.assignment;
+	if(assignment != "brute" && assignment != "gemm" && assignment != "elkan" && assignment != "hamerly" && assignment != "yinyang" && assignment != "kdtree") {
+		std::cerr << "Unknown assignment " << assignment;
+		exit(1);
+	}
 
-	vector<Point> points;
-	string point_name;
+	if(options.deterministic && assignment == "kdtree") {
+		std::cerr << "--deterministic does not work with --assign kdtree";
+		exit(1);
+	}
 
-	for(int i = 0; i < total_points; i++)
-	{
-		vector<double> values;
+	if(options.init != "legacy" && options.init != "kmeans++" && options.init != "kmeans||") {
+		std::cerr << "Unknown seeding " << options.init;
+		exit(1);
+	}
 
-		for(int j = 0; j < total_values; j++)
-		{
-			double value;
-			inputFile >> value;
-			values.push_back(value);
+	if(options.n_init < 1) {
+		std::cerr << "--n-init must be at least 1";
+		exit(1);
+	}
+	// the legacy seeding goes through the global rand() state and ignores --seed
+	if(options.n_init > 1 && options.init == "legacy") {
+		std::cerr << "--n-init needs --init kmeans++ or kmeans||";
+		exit(1);
+	}
+
+	if(options.batch_size > 0 && ((assignment != "brute" && assignment != "gemm") || options.deterministic)) {
+		std::cerr << "--minibatch only works with --assign brute or gemm, without --deterministic";
+		exit(1);
+	}
+
+	if(options.k_from > 0 && (options.batch_size > 0 || options.n_init > 1 || !options.labels.empty() || !options.centroids.empty())) {
+		std::cerr << "--k-sweep does not work with --minibatch, --n-init, --labels or --centroids";
+		exit(1);
+	}
+
+	if(options.processes < 1 || (options.transport != "shm" && options.transport != "tcp")) {
+		std::cerr << "--processes must be at least 1 and --transport shm or tcp";
+		exit(1);
+	}
+	if(options.processes > 1 && (assignment == "kdtree" || options.batch_size > 0 || options.n_init > 1 || options.k_from > 0)) {
+		std::cerr << "--processes does not work with --assign kdtree, --minibatch, --n-init or --k-sweep";
+		exit(1);
+	}
+
+	if(options.numa && (options.deterministic || assignment == "kdtree" || options.batch_size > 0 || options.n_init > 1 || options.k_from > 0)) {
+		std::cerr << "--numa does not work with --deterministic, --assign kdtree, --minibatch, --n-init or --k-sweep";
+		exit(1);
+	}
+
+	bool single = options.precision == "float32";
+	if(!single && options.precision != "float64") {
+		std::cerr << "Unknown precision " << options.precision;
+		exit(1);
+	}
+	if(single && assignment != "brute" && assignment != "gemm") {
+		std::cerr << "--precision float32 only works with --assign brute or gemm";
+		exit(1);
+	}
+
+	// Rank 0 creates the allreduce endpoint and starts the other processes on this very
+	// command line plus their rank and the endpoint; their output is dropped and their
+	// telemetry goes to FILE.rank. Every process loads the whole dataset (a binary one is
+	// only mapped) and runs the same seeding, so they all start from the same centers.
+	unique_ptr<Allreduce> comm;
+	vector<pid_t> workers;
+	if(options.processes > 1) {
+		comm = makeAllreduce(options.transport, options.rank, options.processes, options.endpoint);
+		if(options.rank == 0) {
+			string endpoint = comm->getEndpoint();
+			for(int r = 1; r < options.processes; r++) {
+				string rank = to_string(r);
+				vector<char*> args(argv, argv + argc);
+				args.insert(args.end(), {(char*)"--rank", (char*)rank.c_str(), (char*)"--endpoint", (char*)endpoint.c_str(), nullptr});
+				cout.flush();
+				pid_t pid = fork();
+				if(pid == 0) {
+					int null = open("/dev/null", O_WRONLY);
+					dup2(null, STDOUT_FILENO);
+					execv("/proc/self/exe", args.data());
+					std::cerr << "Unable to start process " << r;
+					_exit(1);
+				}
+				workers.push_back(pid);
+				comm->setPeer(r, pid);
+			}
+		} else if(!options.telemetry.empty()) {
+			options.telemetry += "." + to_string(options.rank);
 		}
+		comm->connect();
+	}
 
-		if(has_name)
-		{
-			inputFile >> point_name;
-			Point p(i, values, point_name);
-			points.push_back(p);
+	// text or binary (see kmeans-convert)
+	auto begin_load = chrono::high_resolution_clock::now();
+	Dataset dataset;
+	if (!dataset.open(filename)) {
+		std::cerr << "Unable to open " << filename << ": " << dataset.getError();
+		exit(1);
+	}
+	// the sparse kernel only covers the brute force search over float64 coordinates, and
+	// the seedings, the mini-batches, the sweep and numa read the points dense
+	if(dataset.isSparse() && (assignment != "brute" || single || options.init != "legacy" || options.batch_size > 0
+		|| options.k_from > 0 || options.numa)) {
+		std::cerr << "A sparse dataset only works with --assign brute, --precision float64 and --init legacy, without --minibatch, --k-sweep or --numa";
+		exit(1);
+	}
+	if(single)
+		dataset.prepareSingle();
+	auto end_load = chrono::high_resolution_clock::now();
+
+	cout << "LOAD TIME = "<<std::chrono::duration_cast<std::chrono::microseconds>(end_load-begin_load).count()<<"\n\n";
+
+	// every worker slot of the arena gets its own View, see KMeans::run; the global limit
+	// lets --threads go past the number of cores
+	// the processes of a sharded run split the cores between them
+	int threads = options.threads > 0 ? options.threads : max(1, tbb::this_task_arena::max_concurrency() / options.processes);
+	tbb::global_control control(tbb::global_control::max_allowed_parallelism, threads);
+	tbb::task_arena arena(threads);
+
+	// Every node gets a share of the threads and of the points of this shard, and copies
+	// them into pages of its own before the run; the points of the other shards, only read
+	// by the seeding, stay with the main thread
+	unique_ptr<Numa> numa;
+	if(options.numa) {
+		numa.reset(new Numa(threads));
+		pair<int, int> shard = shardRange(dataset.getTotalPoints(), options.rank, options.processes);
+		bool placed = dataset.relocate([&](auto& copy) {
+			copy(0, shard.first);
+			copy(shard.second, dataset.getTotalPoints());
+			numa->forEachNode([&](int node) {
+				pair<int, int> range = numa->getRange(node, shard.first, shard.second);
+				tbb::parallel_for(tbb::blocked_range<int>(range.first, range.second),
+					[&](const tbb::blocked_range<int>& r) {
+						copy(r.begin(), r.end());
+					}
+				);
+			});
+		});
+		if(!placed) {
+			std::cerr << "Unable to place the dataset on the NUMA nodes";
+			exit(1);
 		}
+	}
+
+	arena.execute([&] {
+		if(options.k_from > 0 && single)
+			sweep<float>(dataset, options);
+		else if(options.k_from > 0)
+			sweep<double>(dataset, options);
+		else if(single)
+			cluster<float>(dataset, options, comm.get(), numa.get());
 		else
-		{
-			Point p(i, values);
-			points.push_back(p);
+			cluster<double>(dataset, options, comm.get(), numa.get());
+	});
+
+	for(pid_t pid : workers) {
+		int status;
+		if(waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			std::cerr << "Process " << pid << " failed";
+			exit(1);
 		}
 	}
 
-	KMeans kmeans(K, total_points, total_values, max_iterations);
-	kmeans.run(points);
-
 	return 0;
 }
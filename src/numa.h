@@ -0,0 +1,216 @@
+// NUMA placement for kmeans-parallel (--numa)
+// The nodes and their CPUs are read from /sys/devices/system/node, limited to the
+// CPUs the process may run on; a machine without that tree, or with a single
+// node, ends up with one node holding every CPU. Every node gets its own
+// tbb::task_arena whose threads are pinned to the CPUs of the node by a
+// task_scheduler_observer, so memory first written from inside a node's arena is
+// placed on that node and the threads reading it later stay there. Per point
+// arrays use UntouchedAllocator, so their pages are not written before the node
+// that owns the points fills them.
+
+#ifndef KMEANS_NUMA_H
+#define KMEANS_NUMA_H
+
+#include <algorithm>
+#include <fstream>
+#include <memory>
+#include <sched.h>
+#include <string>
+#include <utility>
+#include <vector>
+#include <tbb/tbb.h>
+#include <tbb/task_scheduler_observer.h>
+
+// highest node id looked for under /sys/devices/system/node
+const int NUMA_MAX_NODES = 1024;
+
+// std::allocator whose resize() leaves the new values unwritten, for the per point arrays
+// that every point fills before reading, so that their pages are first touched by the
+// thread that assigns the point rather than by the one that sizes the array
+template<typename T>
+struct UntouchedAllocator : std::allocator<T>
+{
+	template<typename U>
+	struct rebind
+	{
+		typedef UntouchedAllocator<U> other;
+	};
+
+	UntouchedAllocator() = default;
+
+	template<typename U>
+	UntouchedAllocator(const UntouchedAllocator<U>&) {}
+
+	template<typename U>
+	void construct(U* p)
+	{
+		::new((void*)p) U;
+	}
+
+	template<typename U, typename... Args>
+	void construct(U* p, Args&&... args)
+	{
+		::new((void*)p) U(std::forward<Args>(args)...);
+	}
+};
+
+template<typename T>
+using UntouchedVector = std::vector<T, UntouchedAllocator<T>>;
+
+// pin every thread that joins an arena to a set of CPUs, and give it back the CPUs of the
+// process when it leaves, since TBB workers move between arenas
+class NumaPinning : public tbb::task_scheduler_observer
+{
+private:
+	cpu_set_t cpus, previous;
+
+public:
+	NumaPinning(tbb::task_arena& arena, const std::vector<int>& cpus) : tbb::task_scheduler_observer(arena)
+	{
+		CPU_ZERO(&this->cpus);
+		for(int cpu : cpus)
+			CPU_SET(cpu, &this->cpus);
+		sched_getaffinity(0, sizeof(previous), &previous);
+		observe(true);
+	}
+
+	~NumaPinning()
+	{
+		observe(false);
+	}
+
+	void on_scheduler_entry(bool worker) override
+	{
+		sched_setaffinity(0, sizeof(cpus), &cpus);
+	}
+
+	void on_scheduler_exit(bool worker) override
+	{
+		sched_setaffinity(0, sizeof(previous), &previous);
+	}
+};
+
+class Numa
+{
+private:
+	struct Node
+	{
+		int id; // -1 when the topology could not be read
+		std::vector<int> cpus;
+		std::unique_ptr<tbb::task_arena> arena;
+		std::unique_ptr<NumaPinning> pinning;
+		std::unique_ptr<tbb::task_group> group;
+	};
+
+	std::vector<Node> nodes;
+
+	// "0-3,8,10-11"
+	static std::vector<int> parseCpuList(const std::string& list)
+	{
+		std::vector<int> cpus;
+		size_t p = 0;
+		while(p < list.size()) {
+			size_t end = list.find(',', p);
+			std::string item = list.substr(p, end == std::string::npos ? std::string::npos : end - p);
+			size_t dash = item.find('-');
+			if(!item.empty()) {
+				int first = std::stoi(item);
+				int last = dash == std::string::npos ? first : std::stoi(item.substr(dash + 1));
+				for(int cpu = first; cpu <= last; cpu++)
+					cpus.push_back(cpu);
+			}
+			if(end == std::string::npos)
+				break;
+			p = end + 1;
+		}
+		return cpus;
+	}
+
+public:
+	// threads is split between the nodes in proportion to their CPUs, at least one each
+	Numa(int threads)
+	{
+		cpu_set_t allowed;
+		CPU_ZERO(&allowed);
+		sched_getaffinity(0, sizeof(allowed), &allowed);
+
+		for(int id = 0; id < NUMA_MAX_NODES; id++) {
+			std::ifstream file("/sys/devices/system/node/node" + std::to_string(id) + "/cpulist");
+			std::string list;
+			if(!file || !std::getline(file, list))
+				continue;
+
+			Node node;
+			node.id = id;
+			for(int cpu : parseCpuList(list)) {
+				if(cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed))
+					node.cpus.push_back(cpu);
+			}
+			if(!node.cpus.empty())
+				this->nodes.push_back(std::move(node));
+		}
+
+		if(this->nodes.empty()) {
+			Node node;
+			node.id = -1;
+			for(int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+				if(CPU_ISSET(cpu, &allowed))
+					node.cpus.push_back(cpu);
+			}
+			this->nodes.push_back(std::move(node));
+		}
+
+		int total_cpus = 0;
+		for(Node& node : this->nodes)
+			total_cpus += node.cpus.size();
+		for(size_t n = 0; n < this->nodes.size(); n++) {
+			Node& node = this->nodes[n];
+			int concurrency = std::max(1, (int)((long)threads * node.cpus.size() / total_cpus));
+			// the calling thread only has a slot kept in the first node, the one forEachNode()
+			// waits on first; the other nodes are all workers, so they start right away
+			node.arena.reset(new tbb::task_arena(concurrency, n == 0 ? 1 : 0));
+			node.arena->initialize();
+			node.pinning.reset(new NumaPinning(*node.arena, node.cpus));
+			node.group.reset(new tbb::task_group());
+		}
+	}
+
+	int getTotalNodes()
+	{
+		return this->nodes.size();
+	}
+
+	int getConcurrency(int node)
+	{
+		return this->nodes[node].arena->max_concurrency();
+	}
+
+	// part of the points [begin, end) owned by node, in proportion to its threads
+	std::pair<int, int> getRange(int node, int begin, int end)
+	{
+		long total = 0, before = 0;
+		for(int n = 0; n < getTotalNodes(); n++) {
+			total += getConcurrency(n);
+			if(n < node)
+				before += getConcurrency(n);
+		}
+		long count = end - begin;
+		return {begin + (int)(count * before / total), begin + (int)(count * (before + getConcurrency(node)) / total)};
+	}
+
+	// run f(node) for every node inside its own arena, all at once, and wait for them
+	template<typename F>
+	void forEachNode(F f)
+	{
+		for(int n = 0; n < getTotalNodes(); n++) {
+			Node& node = this->nodes[n];
+			node.arena->execute([&, n] {
+				node.group->run([&, n] { f(n); });
+			});
+		}
+		for(Node& node : this->nodes)
+			node.arena->execute([&] { node.group->wait(); });
+	}
+};
+
+#endif
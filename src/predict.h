@@ -0,0 +1,137 @@
+// Assignment of new points to trained centers (kmeans-parallel predict)
+// A Predictor holds a fixed set of centers in the transposed block read by the
+// nearest center kernels (see distance.h), with the widest kernel the CPU
+// supports, and labels batches of points in parallel into buffers owned by the
+// caller. It never changes the centers, so one Predictor can serve any number of
+// batches, from any number of threads.
+//
+// The centers are saved by kmeans-parallel --centroids in a text file: a "K D"
+// line followed by K rows of D values, written with enough digits to read back
+// the same doubles.
+
+#ifndef KMEANS_PREDICT_H
+#define KMEANS_PREDICT_H
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <limits>
+#include <string>
+#include <vector>
+#include <tbb/tbb.h>
+
+#include "dataset.h"
+#include "distance.h"
+
+// write K row-major centers of total_values values, false if the file could not be written
+inline bool saveCentroids(const std::string& filename, const std::vector<double>& centers, int K, int total_values)
+{
+	std::ofstream output(filename);
+	output << std::setprecision(std::numeric_limits<double>::max_digits10);
+	output << K << " " << total_values << "\n";
+	for(int k = 0; k < K; k++) {
+		for(int j = 0; j < total_values; j++)
+			output << (j > 0 ? " " : "") << centers[(size_t)k * total_values + j];
+		output << "\n";
+	}
+	return !output.fail();
+}
+
+// read a file written by saveCentroids(), false if it is missing or malformed
+inline bool loadCentroids(const std::string& filename, std::vector<double>& centers, int& K, int& total_values)
+{
+	std::ifstream input(filename);
+	if(!(input >> K >> total_values) || K < 1 || total_values < 1)
+		return false;
+	centers.resize((size_t)K * total_values);
+	for(double& value : centers)
+		input >> value;
+	return !input.fail();
+}
+
+class Predictor
+{
+private:
+	int K, total_values, stride;
+	std::string isa; // instruction set of the kernel, resolved from "auto"
+	std::vector<double> centers; // row-major, for the distances
+	std::vector<double, tbb::cache_aligned_allocator<double>> centroids; // block read by the kernels
+	std::vector<double> center_norms; // ||c||^2, for the sparse kernel
+	NearestCenterFn nearest_center;
+
+public:
+	// centers holds K row-major centers of total_values values; isa as for selectNearestCenter
+	Predictor(const std::vector<double>& centers, int K, int total_values, const std::string& isa = "auto")
+	{
+		this->K = K;
+		this->total_values = total_values;
+		this->centers = centers;
+		this->isa = isa;
+		this->nearest_center = selectNearestCenter(total_values, this->isa);
+
+		this->stride = centroidStride(K);
+		this->centroids.assign((size_t)stride * total_values, INFINITY);
+		this->center_norms.assign(K, 0.0);
+		for(int k = 0; k < K; k++) {
+			for(int j = 0; j < total_values; j++) {
+				double value = centers[(size_t)k * total_values + j];
+				this->centroids[(size_t)j * stride + k] = value;
+				this->center_norms[k] += value * value;
+			}
+		}
+	}
+
+	int getK()
+	{
+		return this->K;
+	}
+
+	int getTotalValues()
+	{
+		return this->total_values;
+	}
+
+	std::string getInstructionSet()
+	{
+		return this->isa;
+	}
+
+	// nearest center of count row-major points into labels[0, count) and, unless distances
+	// is null, the squared distance to it into distances[0, count)
+	void predict(const double* points, size_t count, int* labels, double* distances)
+	{
+		tbb::parallel_for(tbb::blocked_range<size_t>(0, count), [&](const tbb::blocked_range<size_t>& r) {
+			for(size_t i = r.begin(); i < r.end(); i++) {
+				const double* point = points + i * total_values;
+				labels[i] = nearest_center(point, centroids.data(), K, stride, total_values);
+				if(distances != nullptr)
+					distances[i] = squaredDistance(point, centers.data() + (size_t)labels[i] * total_values, total_values);
+			}
+		});
+	}
+
+	// the same for the points [first, first + count) of dataset, dense or sparse, into
+	// labels[0, count) and distances[0, count)
+	void predict(Dataset& dataset, int first, int count, int* labels, double* distances)
+	{
+		if(!dataset.isSparse()) {
+			predict(dataset.getPoint(first), count, labels, distances);
+			return;
+		}
+
+		tbb::parallel_for(tbb::blocked_range<int>(0, count), [&](const tbb::blocked_range<int>& r) {
+			std::vector<double> dots(K);
+			for(int i = r.begin(); i < r.end(); i++) {
+				int index = first + i;
+				double distance;
+				labels[i] = nearestCenterSparse(dataset.getColumns(index), dataset.getEntries(index), dataset.getEntryCount(index),
+					dataset.getNorm(index), centroids.data(), center_norms.data(), K, stride, dots.data(), distance);
+				if(distances != nullptr)
+					distances[i] = distance;
+			}
+		});
+	}
+};
+
+#endif
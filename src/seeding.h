@@ -0,0 +1,240 @@
+// Seeding strategies for the initial cluster centers
+// Both return K distinct point indexes and only depend on the seed, never on
+// the number of threads: per-point random numbers come from a counter based
+// generator and every floating point sum goes through
+// parallel_deterministic_reduce.
+//
+// kmeans++  : D^2 sampling, one center per pass over the points
+// kmeans||  : a few oversampling passes that each pick about `oversampling`
+//             points in parallel, then a weighted kmeans++ over the candidates
+
+#ifndef KMEANS_SEEDING_H
+#define KMEANS_SEEDING_H
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+#include <tbb/tbb.h>
+
+#include "dataset.h"
+#include "distance.h"
+
+const size_t SEEDING_GRAIN = 4096;
+
+// splitmix64, used as a counter based generator: the same (seed, stream, index)
+// always gives the same number in [0, 1)
+inline double seedUniform(uint64_t seed, uint64_t stream, uint64_t index)
+{
+	uint64_t z = seed * 0x9E3779B97F4A7C15ull + stream * 0xBF58476D1CE4E5B9ull + index * 0x94D049BB133111EBull;
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+	z = z ^ (z >> 31);
+	return (z >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// sum of weights[0, n) with a fixed reduction shape
+inline double deterministicSum(const std::vector<double>& weights)
+{
+	return tbb::parallel_deterministic_reduce(
+		tbb::blocked_range<size_t>(0, weights.size(), SEEDING_GRAIN), 0.0,
+		[&](const tbb::blocked_range<size_t>& r, double sum) {
+			for(size_t i = r.begin(); i < r.end(); i++)
+				sum += weights[i];
+			return sum;
+		},
+		std::plus<double>()
+	);
+}
+
+// index drawn with probability weights[i] / total, or -1 when every weight is 0
+inline int sampleIndex(const std::vector<double>& weights, double total, double uniform)
+{
+	if(total <= 0.0)
+		return -1;
+
+	double target = uniform * total, sum = 0.0;
+	int last = -1;
+	for(size_t i = 0; i < weights.size(); i++) {
+		if(weights[i] <= 0.0)
+			continue;
+		sum += weights[i];
+		last = i;
+		if(sum > target)
+			break;
+	}
+	return last;
+}
+
+// lower min_dist[i] to the squared distance between point i and point center
+inline void updateMinDistances(Dataset& dataset, std::vector<double>& min_dist, int center)
+{
+	int total_values = dataset.getTotalValues();
+	const double* c = dataset.getPoint(center);
+	tbb::parallel_for(tbb::blocked_range<size_t>(0, min_dist.size(), SEEDING_GRAIN),
+		[&](const tbb::blocked_range<size_t>& r) {
+			for(size_t i = r.begin(); i < r.end(); i++)
+				min_dist[i] = std::min(min_dist[i], squaredDistance(dataset.getPoint(i), c, total_values));
+		}
+	);
+}
+
+// weighted kmeans++ over a candidate set, returns positions in candidates
+inline std::vector<int> weightedKMeansPlusPlus(Dataset& dataset, const std::vector<int>& candidates,
+	const std::vector<double>& weights, int K, uint64_t seed)
+{
+	int total_values = dataset.getTotalValues();
+	size_t n = candidates.size();
+	std::vector<double> min_dist(n, INFINITY), score(n);
+	std::vector<char> chosen(n, 0);
+	std::vector<int> picked;
+
+	for(int k = 0; k < K && picked.size() < n; k++) {
+		for(size_t i = 0; i < n; i++)
+			score[i] = chosen[i] ? 0.0 : (k == 0 ? weights[i] : weights[i] * min_dist[i]);
+
+		double total = 0.0;
+		for(size_t i = 0; i < n; i++)
+			total += score[i];
+
+		int p = sampleIndex(score, total, seedUniform(seed, 1, k));
+		if(p < 0) // the rest coincide with a chosen candidate
+			p = std::find(chosen.begin(), chosen.end(), 0) - chosen.begin();
+
+		chosen[p] = 1;
+		picked.push_back(p);
+		const double* c = dataset.getPoint(candidates[p]);
+		for(size_t i = 0; i < n; i++)
+			min_dist[i] = std::min(min_dist[i], squaredDistance(dataset.getPoint(candidates[i]), c, total_values));
+	}
+	return picked;
+}
+
+// transposed block of the candidate points [from, to) in the layout read by the kernels of distance.h
+inline int transposeCandidates(Dataset& dataset, const std::vector<int>& candidates, size_t from, size_t to,
+	std::vector<double, tbb::cache_aligned_allocator<double>>& block)
+{
+	int total_values = dataset.getTotalValues();
+	int count = to - from;
+	int stride = centroidStride(count);
+	block.assign((size_t)stride * total_values, INFINITY);
+	for(int c = 0; c < count; c++) {
+		for(int j = 0; j < total_values; j++)
+			block[(size_t)j * stride + c] = dataset.getValue(candidates[from + c], j);
+	}
+	return stride;
+}
+
+// add distinct indexes not picked yet until there are K of them
+inline void fillSeeds(std::vector<int>& seeds, int total_points, int K)
+{
+	std::vector<char> used(total_points, 0);
+	for(int s : seeds)
+		used[s] = 1;
+	for(int i = 0; i < total_points && (int)seeds.size() < K; i++) {
+		if(!used[i])
+			seeds.push_back(i);
+	}
+}
+
+inline std::vector<int> seedKMeansPlusPlus(Dataset& dataset, int K, uint64_t seed)
+{
+	int total_points = dataset.getTotalPoints();
+	std::vector<double> min_dist(total_points, INFINITY);
+	std::vector<int> seeds;
+
+	int first = (int)(seedUniform(seed, 0, 0) * total_points);
+	seeds.push_back(first);
+	updateMinDistances(dataset, min_dist, first);
+
+	for(int k = 1; k < K; k++) {
+		int next = sampleIndex(min_dist, deterministicSum(min_dist), seedUniform(seed, 0, k));
+		if(next < 0) // every point sits on a center already
+			break;
+		seeds.push_back(next);
+		updateMinDistances(dataset, min_dist, next);
+	}
+
+	fillSeeds(seeds, total_points, K);
+	return seeds;
+}
+
+// nearest_center is the kernel picked for the dataset dimension (see selectNearestCenter)
+inline std::vector<int> seedKMeansParallel(Dataset& dataset, int K, uint64_t seed, double oversampling, int rounds,
+	NearestCenterFn nearest_center)
+{
+	int total_points = dataset.getTotalPoints();
+	int total_values = dataset.getTotalValues();
+	std::vector<double, tbb::cache_aligned_allocator<double>> block;
+	std::vector<double> min_dist(total_points, INFINITY);
+	std::vector<char> sampled(total_points, 0);
+	std::vector<int> candidates;
+
+	int first = (int)(seedUniform(seed, 0, 0) * total_points);
+	candidates.push_back(first);
+	sampled[first] = 1;
+	updateMinDistances(dataset, min_dist, first);
+
+	// oversampling rounds: every point is picked independently with probability l * d^2 / cost
+	for(int round = 0; round < rounds; round++) {
+		double cost = deterministicSum(min_dist);
+		if(cost <= 0.0)
+			break;
+
+		size_t before = candidates.size();
+		tbb::parallel_for(tbb::blocked_range<size_t>(0, total_points, SEEDING_GRAIN),
+			[&](const tbb::blocked_range<size_t>& r) {
+				for(size_t i = r.begin(); i < r.end(); i++) {
+					if(!sampled[i] && seedUniform(seed, 2 + round, i) * cost < oversampling * min_dist[i])
+						sampled[i] = 2;
+				}
+			}
+		);
+		for(int i = 0; i < total_points; i++) {
+			if(sampled[i] == 2) {
+				sampled[i] = 1;
+				candidates.push_back(i);
+			}
+		}
+
+		// distance from every point to the closest of the new candidates
+		if(candidates.size() == before)
+			continue;
+		int count = candidates.size() - before;
+		int stride = transposeCandidates(dataset, candidates, before, candidates.size(), block);
+		tbb::parallel_for(tbb::blocked_range<size_t>(0, total_points, SEEDING_GRAIN),
+			[&](const tbb::blocked_range<size_t>& r) {
+				for(size_t i = r.begin(); i < r.end(); i++) {
+					int c = nearest_center(dataset.getPoint(i), block.data(), count, stride, total_values);
+					min_dist[i] = std::min(min_dist[i], squaredDistance(dataset.getPoint(i), dataset.getPoint(candidates[before + c]), total_values));
+				}
+			}
+		);
+	}
+
+	// weight every candidate by the number of points closest to it
+	size_t n = candidates.size();
+	int stride = transposeCandidates(dataset, candidates, 0, n, block);
+	std::vector<double> weights = tbb::parallel_reduce(
+		tbb::blocked_range<size_t>(0, total_points, SEEDING_GRAIN), std::vector<double>(n, 0.0),
+		[&](const tbb::blocked_range<size_t>& r, std::vector<double> count) {
+			for(size_t i = r.begin(); i < r.end(); i++)
+				count[nearest_center(dataset.getPoint(i), block.data(), n, stride, total_values)] += 1.0;
+			return count;
+		},
+		[](std::vector<double> a, const std::vector<double>& b) {
+			for(size_t c = 0; c < a.size(); c++)
+				a[c] += b[c];
+			return a;
+		}
+	);
+
+	// recluster the candidates down to K seeds
+	std::vector<int> seeds;
+	for(int p : weightedKMeansPlusPlus(dataset, candidates, weights, K, seed))
+		seeds.push_back(candidates[p]);
+
+	fillSeeds(seeds, total_points, K);
+	return seeds;
+}
+
+#endif
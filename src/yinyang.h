@@ -0,0 +1,243 @@
+// Yinyang k-means assignment
+// The centers are split once, on the first iteration, into about K/10 groups
+// by a small k-means over the centers themselves. Every point keeps an upper
+// bound on the distance to its own center and one lower bound per group.
+// A global filter (the smallest group bound) skips most points outright and a
+// group filter skips whole groups before any exact distance is computed.
+// The per-center local filter of the paper is left out: with bounds that are
+// refreshed lazily it has nothing tighter than the group bound to work with.
+
+#ifndef KMEANS_YINYANG_H
+#define KMEANS_YINYANG_H
+
+#include <algorithm>
+#include <vector>
+#include <tbb/tbb.h>
+
+#include "assignment.h"
+
+class Yinyang : public Assignment
+{
+private:
+	int total_groups;
+	std::vector<int> group_of; // group of every center
+	std::vector<std::vector<int>> groups; // centers of every group
+	// how far the centers of every group (and of any group) may have moved since the start,
+	// summed over the iterations
+	std::vector<double> group_drift;
+	double global_drift;
+
+	// Bounds are stored with the drift of the moment added, so a bound that has not been
+	// touched for a few iterations is read back as stored value - drift now. A point that
+	// passes the global filter then costs O(1) instead of O(groups).
+	// written for every point by the first nearest(), see UntouchedAllocator
+	UntouchedVector<double> upper; // per point, distance to its own center
+	UntouchedVector<double> global_lower; // per point, smallest of the group bounds
+	UntouchedVector<double> lower; // per point and group, distance to the closest center of the group other than its own
+
+	// scratch space for nearest(), one row of K per worker slot, see reserveSlots()
+	std::vector<double> scratch;
+
+	// cluster the centers into total_groups groups with a few Lloyd iterations
+	void groupCenters()
+	{
+		int T = std::min(total_groups, K);
+		std::vector<double> group_centers((size_t)T * total_values);
+		for(int t = 0; t < T; t++) {
+			const double* c = getCenter((int)((long)t * K / T));
+			std::copy(c, c + total_values, group_centers.begin() + (size_t)t * total_values);
+		}
+
+		this->group_of.assign(K, 0);
+		for(int iter = 0; iter < 5; iter++) {
+			for(int i = 0; i < K; i++) {
+				double best_dist = INFINITY;
+				for(int t = 0; t < T; t++) {
+					double dist = squaredDistance(getCenter(i), group_centers.data() + (size_t)t * total_values, total_values);
+					if(dist < best_dist) {
+						best_dist = dist;
+						this->group_of[i] = t;
+					}
+				}
+			}
+
+			std::vector<int> count(T, 0);
+			std::fill(group_centers.begin(), group_centers.end(), 0.0);
+			for(int i = 0; i < K; i++) {
+				int t = this->group_of[i];
+				count[t]++;
+				for(int j = 0; j < total_values; j++)
+					group_centers[(size_t)t * total_values + j] += getCenter(i)[j];
+			}
+			for(int t = 0; t < T; t++) {
+				for(int j = 0; j < total_values && count[t] > 0; j++)
+					group_centers[(size_t)t * total_values + j] /= count[t];
+			}
+		}
+
+		// drop the groups that ended up empty
+		this->groups.clear();
+		std::vector<int> renumber(T, -1);
+		for(int i = 0; i < K; i++) {
+			int t = this->group_of[i];
+			if(renumber[t] == -1) {
+				renumber[t] = this->groups.size();
+				this->groups.emplace_back();
+			}
+			this->group_of[i] = renumber[t];
+			this->groups[renumber[t]].push_back(i);
+		}
+		this->total_groups = this->groups.size();
+	}
+
+public:
+	Yinyang(int total_points, int K, int total_values, int total_groups = 0) : Assignment(K, total_values)
+	{
+		this->total_groups = total_groups > 0 ? total_groups : std::max(1, K / 10);
+		this->upper.resize(total_points);
+		this->global_lower.resize(total_points);
+		this->global_drift = 0.0;
+	}
+
+	int getTotalGroups()
+	{
+		return this->total_groups;
+	}
+
+	void update(const double* centroids, int stride) override
+	{
+		copyCenters(centroids, stride);
+
+		if(first_iteration) {
+			groupCenters();
+			this->lower.resize(this->upper.size() * total_groups);
+			this->group_drift.assign(total_groups, 0.0);
+			return;
+		}
+
+		// a group bound drops by the largest move of a center of the group
+		double max_shift = 0.0;
+		for(int t = 0; t < total_groups; t++) {
+			double group_shift = 0.0;
+			for(int j : this->groups[t])
+				group_shift = std::max(group_shift, shift[j]);
+			this->group_drift[t] += group_shift;
+			max_shift = std::max(max_shift, group_shift);
+		}
+		this->global_drift += max_shift;
+	}
+
+	size_t getCenterBytes() override
+	{
+		return Assignment::getCenterBytes() + K * sizeof(int) + total_groups * sizeof(double);
+	}
+
+	void reserveSlots(int slots) override
+	{
+		this->scratch.resize((size_t)slots * K);
+	}
+
+	int nearest(int index, const double* point, int id_cluster, int slot, long& distances) override
+	{
+		double* lg = this->lower.data() + (size_t)index * total_groups;
+		double* bound = this->scratch.data() + (size_t)slot * K;
+
+		// no bounds yet, compute every distance
+		if(first_iteration) {
+			int best = 0;
+			double best_dist = INFINITY;
+			for(int j = 0; j < K; j++) {
+				double dist = squaredDistance(point, getCenter(j), total_values);
+				bound[j] = lowerBound(sqrt(dist));
+				if(j == 0 || closer(dist, j, best_dist, best)) {
+					best = j;
+					best_dist = dist;
+				}
+			}
+			distances += K;
+
+			std::fill(lg, lg + total_groups, INFINITY);
+			for(int j = 0; j < K; j++) {
+				if(j != best)
+					lg[group_of[j]] = std::min(lg[group_of[j]], bound[j]);
+			}
+			this->global_lower[index] = *std::min_element(lg, lg + total_groups);
+			this->upper[index] = upperBound(sqrt(best_dist));
+			return best;
+		}
+
+		// global filter
+		int a = id_cluster;
+		double u = this->upper[index] + shift[a];
+		double global = this->global_lower[index] - this->global_drift * (1 + BOUND_SLACK);
+		if(u < global) {
+			this->upper[index] = u;
+			return a;
+		}
+
+		double a_dist = squaredDistance(point, getCenter(a), total_values);
+		distances++;
+		u = upperBound(sqrt(a_dist));
+		if(u < global) {
+			this->upper[index] = u;
+			return a;
+		}
+
+		// group filter, the groups that fail it get every distance computed
+		int best = a;
+		double best_dist = a_dist;
+		bound[a] = lowerBound(sqrt(a_dist));
+		global = INFINITY;
+		for(int t = 0; t < total_groups; t++) {
+			double group_lower = lg[t] - this->group_drift[t] * (1 + BOUND_SLACK);
+			if(u < group_lower) {
+				global = std::min(global, group_lower);
+				continue;
+			}
+
+			for(int j : this->groups[t]) {
+				if(j == a)
+					continue;
+
+				double dist = squaredDistance(point, getCenter(j), total_values);
+				distances++;
+				bound[j] = lowerBound(sqrt(dist));
+				if(closer(dist, j, best_dist, best)) {
+					best = j;
+					best_dist = dist;
+					u = upperBound(sqrt(dist));
+				}
+			}
+			// the group has been examined, rebuild its bound below
+			lg[t] = -1.0;
+		}
+
+		for(int t = 0; t < total_groups; t++) {
+			if(lg[t] != -1.0)
+				continue;
+			double group_lower = INFINITY;
+			for(int j : this->groups[t]) {
+				if(j != best)
+					group_lower = std::min(group_lower, bound[j]);
+			}
+			lg[t] = group_lower + this->group_drift[t];
+			global = std::min(global, group_lower);
+		}
+
+		// the old center joins the other centers of its group if its group was not examined
+		if(best != a) {
+			int t = group_of[a];
+			double group_lower = lg[t] - this->group_drift[t] * (1 + BOUND_SLACK);
+			if(bound[a] < group_lower) {
+				lg[t] = bound[a] + this->group_drift[t];
+				global = std::min(global, bound[a]);
+			}
+		}
+
+		this->global_lower[index] = global + this->global_drift;
+		this->upper[index] = u;
+		return best;
+	}
+};
+
+#endif